@@ -0,0 +1,275 @@
+// Compares sequential keep-alive requests with pipelined requests over a loopback link with simulated latency.
+// A delay proxy sits between the client and the upstream, it holds every chunk it forwards for the given latency in both directions.
+// The upstream answers every request on a connection in order, as soon as its headers are complete, so it supports pipelining.
+// The httplib server, which RestServer is built on, reads every request through a new buffered stream, requests that arrived with the previous request are lost.
+// It is only used to measure how long the pipeline takes to detect this and fall back.
+// Usage: pipeline [latency ms = 20] [requests = 200] [pipeline depth = 8]
+
+#include <restpipeline.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Forwards the data of one socket to another, every chunk is written the given latency after it was read
+ */
+class DelayLine final
+{
+public:
+    DelayLine(int from, int to, std::chrono::milliseconds latency) :
+        mFrom(from), mTo(to), mLatency(latency)
+    {
+        mReader = std::thread([this]() { read(); });
+        mWriter = std::thread([this]() { write(); });
+    }
+
+    ~DelayLine()
+    {
+        mReader.join();
+        mWriter.join();
+    }
+
+private:
+    void read()
+    {
+        char buffer[16 * 1024];
+        while(true)
+        {
+            auto size = ::recv(mFrom, buffer, sizeof(buffer), 0);
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(size <= 0)
+            {
+                mClosed = true;
+                mCondition.notify_all();
+                return;
+            }
+            mChunks.push_back({ Clock::now() + mLatency, std::string(buffer, size) });
+            mCondition.notify_all();
+        }
+    }
+
+    void write()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while(true)
+        {
+            mCondition.wait(lock, [this]() { return mClosed || !mChunks.empty(); });
+            if(mChunks.empty())
+            {
+                ::shutdown(mTo, SHUT_WR);
+                return;
+            }
+
+            auto chunk = std::move(mChunks.front());
+            mChunks.pop_front();
+            lock.unlock();
+            std::this_thread::sleep_until(chunk.first);
+            ::send(mTo, chunk.second.data(), chunk.second.size(), MSG_NOSIGNAL);
+            lock.lock();
+        }
+    }
+
+    int mFrom;
+    int mTo;
+    std::chrono::milliseconds mLatency;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<std::pair<Clock::time_point, std::string>> mChunks;
+    bool mClosed = false;
+    std::thread mReader;
+    std::thread mWriter;
+};
+
+
+// Opens a loopback socket, listening when no port to connect to is given
+static int openSocket(int connectPort, int& port)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(connectPort));
+    if(connectPort > 0)
+        return ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 ? fd : -1;
+
+    socklen_t length = sizeof(address);
+    ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    ::listen(fd, 16);
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+    port = ntohs(address.sin_port);
+    return fd;
+}
+
+
+// Answers the GET requests of a connection in order, the body echoes the query
+static void serve(int connection)
+{
+    std::string received;
+    char buffer[16 * 1024];
+    while(true)
+    {
+        auto size = ::recv(connection, buffer, sizeof(buffer), 0);
+        if(size <= 0)
+            break;
+        received.append(buffer, size);
+
+        // Every complete request is answered right away, requests that arrived together are answered together
+        std::string responses;
+        size_t end;
+        while((end = received.find("\r\n\r\n")) != std::string::npos)
+        {
+            auto target_start = received.find(' ') + 1;
+            auto query = received.substr(target_start, received.find(' ', target_start) - target_start);
+            query = query.substr(std::min(query.find('?') + 1, query.size()));
+            auto body = "{\"query\":\"" + query + "\"}";
+            responses += "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+            received.erase(0, end + 4);
+        }
+        ::send(connection, responses.data(), responses.size(), MSG_NOSIGNAL);
+    }
+    ::close(connection);
+}
+
+
+int main(int argc, char** argv)
+{
+    auto latency = std::chrono::milliseconds(argc > 1 ? std::atoi(argv[1]) : 20);
+    int requests = argc > 2 ? std::atoi(argv[2]) : 200;
+    int depth = argc > 3 ? std::atoi(argv[3]) : 8;
+
+    // Upstream, a thread for every connection
+    int server_port = 0;
+    int server = openSocket(0, server_port);
+    std::thread server_thread([server]()
+    {
+        std::vector<std::thread> connections;
+        int connection;
+        while((connection = ::accept(server, nullptr, nullptr)) >= 0)
+            connections.emplace_back(serve, connection);
+        for(auto& thread : connections)
+            thread.join();
+    });
+
+    // Delay proxy, every connection is forwarded to the upstream with the latency added in both directions
+    int proxy_port = 0;
+    int proxy = openSocket(0, proxy_port);
+    std::thread proxy_thread([proxy, server_port, latency]()
+    {
+        std::vector<std::unique_ptr<DelayLine>> lines;
+        while(true)
+        {
+            int client = ::accept(proxy, nullptr, nullptr);
+            if(client < 0)
+                return;
+            int unused = 0;
+            int upstream = openSocket(server_port, unused);
+            lines.emplace_back(std::make_unique<DelayLine>(client, upstream, latency));
+            lines.emplace_back(std::make_unique<DelayLine>(upstream, client, latency));
+        }
+    });
+
+    std::printf("latency %lld ms each way, %i requests, pipeline depth %i\n", static_cast<long long>(latency.count()), requests, depth);
+
+    // Sequential, one round trip per request over a keep-alive connection
+    {
+        httplib::Client client("127.0.0.1", proxy_port);
+        client.set_keep_alive(true);
+        auto start = Clock::now();
+        int received = 0;
+        for(int i = 0; i < requests; i++)
+        {
+            auto result = client.Get("/poll?i=" + std::to_string(i));
+            received += result && result->status == httplib::StatusCode::OK_200 ? 1 : 0;
+        }
+        auto duration = std::chrono::duration<double>(Clock::now() - start).count();
+        std::printf("sequential : %i/%i responses in %8.3f s, %8.1f requests/s\n", received, requests, duration, requests / duration);
+        client.stop();
+    }
+
+    // Pipelined, up to depth requests per round trip over a single connection
+    {
+        nap::RestPipeline pipeline("127.0.0.1", proxy_port, 0);
+        auto start = Clock::now();
+        int received = 0;
+        std::string error;
+        for(int first = 0; first < requests; first += depth)
+        {
+            int count = std::min(depth, requests - first);
+            std::vector<nap::RestPipeline::Exchange> exchanges(count);
+            std::vector<nap::RestPipeline::Exchange*> pending;
+            for(int i = 0; i < count; i++)
+            {
+                exchanges[i].mTarget = "/poll?i=" + std::to_string(first + i);
+                pending.emplace_back(&exchanges[i]);
+            }
+
+            if(!pipeline.send(pending, {}, error))
+            {
+                std::printf("pipeline failed : %s\n", error.c_str());
+                break;
+            }
+            for(const auto& exchange : exchanges)
+                received += exchange.mReceived && exchange.mResponse.status == httplib::StatusCode::OK_200 ? 1 : 0;
+        }
+        auto duration = std::chrono::duration<double>(Clock::now() - start).count();
+        std::printf("pipelined  : %i/%i responses in %8.3f s, %8.1f requests/s\n", received, requests, duration, requests / duration);
+        pipeline.close();
+    }
+
+    // Fallback, an upstream that keeps the connection open but loses pipelined requests
+    {
+        httplib::Server upstream;
+        upstream.Get("/poll", [](const httplib::Request&, httplib::Response& res) { res.set_content("{}", "application/json"); });
+        int upstream_port = upstream.bind_to_any_port("127.0.0.1");
+        std::thread upstream_thread([&upstream]() { upstream.listen_after_bind(); });
+        upstream.wait_until_ready();
+
+        nap::RestPipeline pipeline("127.0.0.1", upstream_port, 0);
+        std::vector<nap::RestPipeline::Exchange> exchanges(depth);
+        std::vector<nap::RestPipeline::Exchange*> pending;
+        for(int i = 0; i < depth; i++)
+        {
+            exchanges[i].mTarget = "/poll?i=" + std::to_string(i);
+            pending.emplace_back(&exchanges[i]);
+        }
+
+        auto start = Clock::now();
+        std::string error;
+        pipeline.send(pending, {}, error);
+        auto duration = std::chrono::duration<double>(Clock::now() - start).count();
+        int received = 0;
+        for(const auto& exchange : exchanges)
+            received += exchange.mReceived ? 1 : 0;
+        std::printf("fallback   : %i/%i responses in %8.3f s, pipelining %s%s%s\n", received, depth, duration,
+                    pipeline.isSupported() ? "supported" : "unsupported", error.empty() ? "" : " : ", error.c_str());
+
+        pipeline.close();
+        upstream.stop();
+        upstream_thread.join();
+    }
+
+    for(int socket : { proxy, server })
+    {
+        ::shutdown(socket, SHUT_RDWR);
+        ::close(socket);
+    }
+    proxy_thread.join();
+    server_thread.join();
+    return 0;
+}
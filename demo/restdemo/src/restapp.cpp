@@ -139,7 +139,7 @@ namespace nap
     			params.emplace_back(std::make_unique<APIString>("stringValue", mStringInput));
 				mRestClient->get(mAddressString, params, [this](const RestResponse& response)
 				{
-					mResponseText = response.mData;
+					mResponseText = response.getData();
 				},
 				[this](const utility::ErrorState& error)
 				{
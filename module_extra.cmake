@@ -10,4 +10,40 @@ find_path(HTTPLIB_DIR
 
 message(STATUS "httplib dir: ${HTTPLIB_DIR}")
 
-target_include_directories(${PROJECT_NAME} PUBLIC ${HTTPLIB_DIR})
\ No newline at end of file
+target_include_directories(${PROJECT_NAME} PUBLIC ${HTTPLIB_DIR})
+
+# patched copy of httplib.h that can skip parsing the query string, used by the LazyQueryParsing option of the RestServer
+include(${CMAKE_CURRENT_LIST_DIR}/patches/httplib_query_parsing.cmake)
+if(NAPREST_HTTPLIB_QUERY_PARSING_PATCHED)
+    target_include_directories(${PROJECT_NAME} BEFORE PUBLIC ${NAPREST_HTTPLIB_PATCHED_DIR})
+    target_compile_definitions(${PROJECT_NAME} PUBLIC NAPREST_HTTPLIB_QUERY_PARSING)
+endif()
+
+# optional compression, httplib negotiates and decodes gzip / deflate with zlib and br with brotli
+find_package(ZLIB QUIET)
+if(ZLIB_FOUND)
+    message(STATUS "httplib zlib support: ${ZLIB_LIBRARIES}")
+    target_compile_definitions(${PROJECT_NAME} PUBLIC CPPHTTPLIB_ZLIB_SUPPORT)
+    target_link_libraries(${PROJECT_NAME} PRIVATE ZLIB::ZLIB)
+endif()
+
+find_path(BROTLI_INCLUDE_DIR NAMES brotli/decode.h)
+find_library(BROTLI_COMMON_LIBRARY NAMES brotlicommon)
+find_library(BROTLI_DEC_LIBRARY NAMES brotlidec)
+find_library(BROTLI_ENC_LIBRARY NAMES brotlienc)
+if(BROTLI_INCLUDE_DIR AND BROTLI_COMMON_LIBRARY AND BROTLI_DEC_LIBRARY AND BROTLI_ENC_LIBRARY)
+    message(STATUS "httplib brotli support: ${BROTLI_DEC_LIBRARY}")
+    target_compile_definitions(${PROJECT_NAME} PUBLIC CPPHTTPLIB_BROTLI_SUPPORT)
+    target_include_directories(${PROJECT_NAME} PUBLIC ${BROTLI_INCLUDE_DIR})
+    target_link_libraries(${PROJECT_NAME} PRIVATE ${BROTLI_ENC_LIBRARY} ${BROTLI_DEC_LIBRARY} ${BROTLI_COMMON_LIBRARY})
+endif()
+
+# loopback tests of the client, run with ctest
+option(NAPREST_BUILD_TESTS "Build the naprest loopback tests" OFF)
+if(NAPREST_BUILD_TESTS)
+    enable_testing()
+    add_executable(naprest_test ${CMAKE_CURRENT_LIST_DIR}/test/restclienttest.cpp)
+    target_include_directories(naprest_test PRIVATE ${CMAKE_CURRENT_LIST_DIR}/src)
+    target_link_libraries(naprest_test PRIVATE ${PROJECT_NAME})
+    add_test(NAME naprest_test COMMAND naprest_test)
+endif()
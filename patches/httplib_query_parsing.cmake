@@ -0,0 +1,62 @@
+# Patch for the vendored httplib, applied at configure time to a copy of httplib.h in the build directory.
+# The vendored header itself is never modified, upgrading httplib only requires checking that this patch still applies.
+#
+# Adds Server::set_query_parsing(bool). When disabled, the server does not parse the query string into Request::params,
+# RestServer then decodes the declared parameters of a function straight from Request::target (LazyQueryParsing).
+#
+# Input : HTTPLIB_DIR, the directory of the vendored httplib.h
+# Output: NAPREST_HTTPLIB_QUERY_PARSING_PATCHED, TRUE when the patched header was written to NAPREST_HTTPLIB_PATCHED_DIR
+
+set(NAPREST_HTTPLIB_PATCHED_DIR ${CMAKE_CURRENT_BINARY_DIR}/httplib_patched)
+set(NAPREST_HTTPLIB_QUERY_PARSING_PATCHED FALSE)
+set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${HTTPLIB_DIR}/httplib.h ${CMAKE_CURRENT_LIST_FILE})
+
+file(READ ${HTTPLIB_DIR}/httplib.h httplib_source)
+set(httplib_patched "${httplib_source}")
+
+# Replaces the unique anchor of a hunk, leaves the header unpatched when the anchor is missing.
+# Hunks are passed one by one, they contain semicolons and can't be stored in a cmake list.
+function(naprest_apply_hunk anchor replacement)
+    if(NOT hunks_apply)
+        return()
+    endif()
+    string(FIND "${httplib_patched}" "${anchor}" anchor_position)
+    if(anchor_position EQUAL -1)
+        message(WARNING "naprest: httplib query parsing patch does not apply to ${HTTPLIB_DIR}/httplib.h, LazyQueryParsing is disabled. Missing:\n${anchor}")
+        set(hunks_apply FALSE PARENT_SCOPE)
+        return()
+    endif()
+    string(REPLACE "${anchor}" "${replacement}" patched "${httplib_patched}")
+    set(httplib_patched "${patched}" PARENT_SCOPE)
+endfunction()
+
+# Every hunk is a literal replacement of a unique anchor in httplib 0.18.3
+set(hunks_apply TRUE)
+naprest_apply_hunk(
+    "  Server &set_payload_max_length(size_t length);\n"
+    "  Server &set_payload_max_length(size_t length);\n\n  // naprest patch: skip parsing the query string into Request::params\n  Server &set_query_parsing(bool on);\n")
+naprest_apply_hunk(
+    "  size_t payload_max_length_ = CPPHTTPLIB_PAYLOAD_MAX_LENGTH;\n"
+    "  size_t payload_max_length_ = CPPHTTPLIB_PAYLOAD_MAX_LENGTH;\n  bool query_parsing_ = true; // naprest patch\n")
+naprest_apply_hunk(
+    "inline bool Server::bind_to_port(const std::string &host, int port,\n"
+    "// naprest patch\ninline Server &Server::set_query_parsing(bool on) {\n  query_parsing_ = on;\n  return *this;\n}\n\ninline bool Server::bind_to_port(const std::string &host, int port,\n")
+naprest_apply_hunk(
+    "                     detail::parse_query_text(rhs_data, rhs_size, req.params);\n"
+    "                     if (query_parsing_) { // naprest patch\n                       detail::parse_query_text(rhs_data, rhs_size, req.params);\n                     }\n")
+if(NOT hunks_apply)
+    return()
+endif()
+
+# Only rewrite the copy when it changed, so sources are not rebuilt on every configure
+set(patched_file ${NAPREST_HTTPLIB_PATCHED_DIR}/httplib.h)
+set(current_patched "")
+if(EXISTS ${patched_file})
+    file(READ ${patched_file} current_patched)
+endif()
+if(NOT current_patched STREQUAL httplib_patched)
+    file(WRITE ${patched_file} "${httplib_patched}")
+endif()
+
+set(NAPREST_HTTPLIB_QUERY_PARSING_PATCHED TRUE)
+message(STATUS "naprest: httplib query parsing patch applied to ${patched_file}")
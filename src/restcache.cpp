@@ -0,0 +1,429 @@
+#include "restcache.h"
+#include "httplibwrapper.h"
+#include "nap/logger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <locale>
+#include <sstream>
+
+RTTI_BEGIN_CLASS(nap::RestCache)
+    RTTI_PROPERTY("MaxMemorySize", &nap::RestCache::mMaxMemorySize, nap::rtti::EPropertyMetaData::Default, "Maximum number of bytes kept in memory")
+    RTTI_PROPERTY("Directory", &nap::RestCache::mDirectory, nap::rtti::EPropertyMetaData::Default, "Directory of the disk tier, leave empty to only cache in memory")
+    RTTI_PROPERTY("MaxDiskSize", &nap::RestCache::mMaxDiskSize, nap::rtti::EPropertyMetaData::Default, "Maximum number of bytes stored on disk")
+RTTI_END_CLASS
+
+namespace nap
+{
+    ////////////////////////////////////////////////////////////////////////////
+    //// Helper functions forwarded declarations
+    ////////////////////////////////////////////////////////////////////////////
+
+    static int64_t now();
+
+    static bool parseFreshness(const httplib::Response& response, int64_t& expires);
+
+    static bool parseHTTPDate(const std::string& date, int64_t& seconds);
+
+    // First line of every file in the disk tier, bump when the format changes
+    static const std::string sFileMagic = "naprest-cache-1";
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestCacheEntry
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool RestCacheEntry::isFresh() const
+    {
+        return now() < mExpires;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestCache
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool RestCache::init(utility::ErrorState& errorState)
+    {
+        if(!errorState.check(mMaxMemorySize >= 0 && mMaxDiskSize >= 0, "%s: cache sizes can't be negative", mID.c_str()))
+            return false;
+
+        if(mDirectory.empty())
+            return true;
+
+        std::error_code error;
+        std::filesystem::create_directories(mDirectory, error);
+        if(!errorState.check(!error, "%s: unable to create cache directory %s : %s", mID.c_str(), mDirectory.c_str(), error.message().c_str()))
+            return false;
+
+        // Account for entries stored by previous sessions
+        std::lock_guard<std::mutex> lock(mDiskMutex);
+        mDiskSize = 0;
+        for(const auto& file : std::filesystem::directory_iterator(mDirectory, error))
+        {
+            if(file.path().extension() == ".cache")
+                mDiskSize += file.file_size(error);
+        }
+        trimDisk();
+        return true;
+    }
+
+
+    std::shared_ptr<const RestCacheEntry> RestCache::find(const std::string& key)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mIndex.find(key);
+            if(it != mIndex.end())
+            {
+                // Move to the front of the LRU
+                mEntries.splice(mEntries.begin(), mEntries, it->second);
+                return it->second->second;
+            }
+        }
+
+        if(mDirectory.empty())
+            return nullptr;
+
+        // Promote entries found on disk back into memory
+        auto entry = read(key);
+        if(entry != nullptr)
+            insert(key, entry);
+        return entry;
+    }
+
+
+    std::shared_ptr<const RestCacheEntry> RestCache::store(const std::string& key, httplib::Response& response)
+    {
+        if(response.status != httplib::StatusCode::OK_200)
+            return nullptr;
+
+        auto entry = std::make_shared<RestCacheEntry>();
+        entry->mETag = response.get_header_value("ETag");
+        entry->mLastModified = response.get_header_value("Last-Modified");
+        if(!parseFreshness(response, entry->mExpires))
+            return nullptr;
+
+        // Responses without a lifetime are only worth storing when they can be revalidated
+        if(!entry->isFresh() && !entry->canRevalidate())
+            return nullptr;
+
+        entry->mContentType = response.get_header_value("Content-Type");
+        entry->mData = std::make_shared<const std::string>(std::move(response.body));
+        response.body.clear();
+
+        insert(key, entry);
+        if(!mDirectory.empty())
+            write(key, *entry);
+        return entry;
+    }
+
+
+    std::shared_ptr<const RestCacheEntry> RestCache::refresh(const std::string& key, const RestCacheEntry& entry, const httplib::Response& response)
+    {
+        auto refreshed = std::make_shared<RestCacheEntry>(entry);
+        if(!parseFreshness(response, refreshed->mExpires))
+            refreshed->mExpires = 0;
+
+        // A 304 may carry updated validators
+        if(response.has_header("ETag"))
+            refreshed->mETag = response.get_header_value("ETag");
+        if(response.has_header("Last-Modified"))
+            refreshed->mLastModified = response.get_header_value("Last-Modified");
+
+        insert(key, refreshed);
+        if(!mDirectory.empty())
+            write(key, *refreshed);
+        return refreshed;
+    }
+
+
+    void RestCache::remove(const std::string& key)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mIndex.find(key);
+            if(it != mIndex.end())
+            {
+                mMemorySize -= it->second->second->getSize() + key.size();
+                mEntries.erase(it->second);
+                mIndex.erase(it);
+            }
+        }
+
+        if(mDirectory.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(mDiskMutex);
+        std::error_code error;
+        auto path = getPath(key);
+        auto size = std::filesystem::file_size(path, error);
+        if(!error && std::filesystem::remove(path, error))
+            mDiskSize -= std::min<uint64_t>(mDiskSize, size);
+    }
+
+
+    void RestCache::clear()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mEntries.clear();
+            mIndex.clear();
+            mMemorySize = 0;
+        }
+
+        if(mDirectory.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(mDiskMutex);
+        std::error_code error;
+        for(const auto& file : std::filesystem::directory_iterator(mDirectory, error))
+        {
+            if(file.path().extension() == ".cache")
+                std::filesystem::remove(file.path(), error);
+        }
+        mDiskSize = 0;
+    }
+
+
+    void RestCache::insert(const std::string& key, std::shared_ptr<const RestCacheEntry> entry)
+    {
+        size_t size = entry->getSize() + key.size();
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        // Replace the existing entry
+        auto it = mIndex.find(key);
+        if(it != mIndex.end())
+        {
+            mMemorySize -= it->second->second->getSize() + key.size();
+            mEntries.erase(it->second);
+            mIndex.erase(it);
+        }
+
+        // Entries larger than the cache are only kept on disk
+        if(size > static_cast<size_t>(mMaxMemorySize))
+            return;
+
+        mEntries.emplace_front(key, std::move(entry));
+        mIndex[key] = mEntries.begin();
+        mMemorySize += size;
+
+        // Evict the least recently used entries
+        while(mMemorySize > static_cast<size_t>(mMaxMemorySize))
+        {
+            auto& last = mEntries.back();
+            mMemorySize -= last.second->getSize() + last.first.size();
+            mIndex.erase(last.first);
+            mEntries.pop_back();
+        }
+    }
+
+
+    std::string RestCache::getPath(const std::string& key) const
+    {
+        // FNV-1a, collisions are detected by comparing the key stored in the file
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for(char c : key)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 0x100000001b3ull;
+        }
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.cache", static_cast<unsigned long long>(hash));
+        return (std::filesystem::path(mDirectory) / name).string();
+    }
+
+
+    std::shared_ptr<const RestCacheEntry> RestCache::read(const std::string& key)
+    {
+        std::ifstream file(getPath(key), std::ios::binary);
+        if(!file)
+            return nullptr;
+
+        // Header lines, followed by the body
+        std::string magic, stored_key, expires, size;
+        auto entry = std::make_shared<RestCacheEntry>();
+        std::getline(file, magic);
+        std::getline(file, stored_key);
+        std::getline(file, entry->mContentType);
+        std::getline(file, entry->mETag);
+        std::getline(file, entry->mLastModified);
+        std::getline(file, expires);
+        std::getline(file, size);
+        if(!file || magic != sFileMagic || stored_key != key)
+            return nullptr;
+
+        entry->mExpires = std::strtoll(expires.c_str(), nullptr, 10);
+        std::string data(std::strtoull(size.c_str(), nullptr, 10), '\0');
+        if(!file.read(data.data(), static_cast<std::streamsize>(data.size())))
+            return nullptr;
+
+        entry->mData = std::make_shared<const std::string>(std::move(data));
+        return entry;
+    }
+
+
+    void RestCache::write(const std::string& key, const RestCacheEntry& entry)
+    {
+        std::lock_guard<std::mutex> lock(mDiskMutex);
+        std::error_code error;
+        auto path = getPath(key);
+        auto temp_path = path + ".tmp";
+
+        // Write to a temporary file first, readers never see a partially written entry
+        {
+            std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+            file << sFileMagic << '\n' << key << '\n' << entry.mContentType << '\n' << entry.mETag << '\n'
+                 << entry.mLastModified << '\n' << entry.mExpires << '\n' << entry.mData->size() << '\n';
+            file.write(entry.mData->data(), static_cast<std::streamsize>(entry.mData->size()));
+            if(!file)
+            {
+                nap::Logger::warn("%s: unable to write cache entry %s", mID.c_str(), temp_path.c_str());
+                std::filesystem::remove(temp_path, error);
+                return;
+            }
+        }
+
+        auto previous_size = std::filesystem::exists(path, error) ? std::filesystem::file_size(path, error) : 0;
+        auto new_size = std::filesystem::file_size(temp_path, error);
+        std::filesystem::rename(temp_path, path, error);
+        if(error)
+        {
+            nap::Logger::warn("%s: unable to store cache entry %s : %s", mID.c_str(), path.c_str(), error.message().c_str());
+            std::filesystem::remove(temp_path, error);
+            return;
+        }
+
+        mDiskSize = mDiskSize - std::min<uint64_t>(mDiskSize, previous_size) + new_size;
+        if(mDiskSize > static_cast<uint64_t>(mMaxDiskSize))
+            trimDisk();
+    }
+
+
+    void RestCache::trimDisk()
+    {
+        if(mDiskSize <= static_cast<uint64_t>(mMaxDiskSize))
+            return;
+
+        // Remove the least recently written entries until the disk tier fits
+        std::error_code error;
+        std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> files;
+        for(const auto& file : std::filesystem::directory_iterator(mDirectory, error))
+        {
+            if(file.path().extension() == ".cache")
+                files.emplace_back(file.last_write_time(error), file.path());
+        }
+        std::sort(files.begin(), files.end());
+
+        for(const auto& [time, path] : files)
+        {
+            if(mDiskSize <= static_cast<uint64_t>(mMaxDiskSize))
+                break;
+            auto size = std::filesystem::file_size(path, error);
+            if(std::filesystem::remove(path, error))
+                mDiskSize -= std::min<uint64_t>(mDiskSize, size);
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// Helper functions
+    ////////////////////////////////////////////////////////////////////////////
+
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+
+    static bool parseFreshness(const httplib::Response& response, int64_t& expires)
+    {
+        // A response that varies on every request header can't be reused
+        if(response.get_header_value("Vary") == "*")
+            return false;
+
+        // Cache-Control directives are comma separated and case insensitive, max-age is relative to the age of the response
+        int64_t max_age = -1;
+        std::string cache_control = response.get_header_value("Cache-Control");
+        std::transform(cache_control.begin(), cache_control.end(), cache_control.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        size_t start = 0;
+        while(start < cache_control.size())
+        {
+            size_t end = cache_control.find(',', start);
+            if(end == std::string::npos)
+                end = cache_control.size();
+
+            std::string directive = cache_control.substr(start, end - start);
+            directive.erase(0, directive.find_first_not_of(" \t"));
+            directive.erase(directive.find_last_not_of(" \t") + 1);
+            start = end + 1;
+
+            if(directive == "no-store")
+                return false;
+
+            // Always revalidate
+            if(directive == "no-cache")
+            {
+                expires = 0;
+                return true;
+            }
+
+            if(directive.compare(0, 8, "max-age=") == 0)
+                max_age = std::strtoll(directive.c_str() + 8, nullptr, 10);
+        }
+
+        int64_t age = std::strtoll(response.get_header_value("Age").c_str(), nullptr, 10);
+        if(max_age >= 0)
+        {
+            expires = max_age > age ? now() + max_age - age : 0;
+            return true;
+        }
+
+        // Without max-age the lifetime is the time between Date and Expires, an invalid Expires means already expired
+        expires = 0;
+        int64_t expires_date = 0;
+        if(!response.has_header("Expires") || !parseHTTPDate(response.get_header_value("Expires"), expires_date))
+            return true;
+
+        int64_t date = 0;
+        if(!parseHTTPDate(response.get_header_value("Date"), date))
+            date = now();
+
+        int64_t lifetime = expires_date - date;
+        expires = lifetime > age ? now() + lifetime - age : 0;
+        return true;
+    }
+
+
+    static bool parseHTTPDate(const std::string& date, int64_t& seconds)
+    {
+        // IMF-fixdate, followed by the obsolete RFC 850 and asctime formats recipients must accept
+        static const char* formats[] = { "%a, %d %b %Y %H:%M:%S", "%A, %d-%b-%y %H:%M:%S", "%a %b %d %H:%M:%S %Y" };
+        for(const char* format : formats)
+        {
+            std::tm time = {};
+            std::istringstream stream(date);
+            stream.imbue(std::locale::classic());
+            stream >> std::get_time(&time, format);
+            if(stream.fail())
+                continue;
+
+            // Dates are always in GMT, convert to days since epoch without depending on the local time zone
+            int64_t year = time.tm_year + 1900;
+            int64_t month = time.tm_mon + 1;
+            year -= month <= 2 ? 1 : 0;
+            int64_t era = (year >= 0 ? year : year - 399) / 400;
+            int64_t year_of_era = year - era * 400;
+            int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + time.tm_mday - 1;
+            int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+            int64_t days = era * 146097 + day_of_era - 719468;
+
+            seconds = days * 86400 + time.tm_hour * 3600 + time.tm_min * 60 + time.tm_sec;
+            return true;
+        }
+        return false;
+    }
+}
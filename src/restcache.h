@@ -0,0 +1,148 @@
+#pragma once
+
+#include <nap/resource.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "restresponse.h"
+
+namespace httplib
+{
+    struct Response;
+}
+
+namespace nap
+{
+    /**
+     * A cached response and the validators needed to revalidate it
+     */
+    struct NAPAPI RestCacheEntry
+    {
+        std::shared_ptr<const std::string> mData;   ///< The body, shared between entries that are refreshed after revalidation
+        std::string mContentType;                   ///< The content type of the body
+        std::string mETag;                          ///< Sent as If-None-Match when revalidating
+        std::string mLastModified;                  ///< Sent as If-Modified-Since when revalidating
+        int64_t mExpires = 0;                       ///< Seconds since epoch after which the entry must be revalidated
+
+        /**
+         * @return if the entry can be used without revalidating it
+         */
+        bool isFresh() const;
+
+        /**
+         * @return if the entry has a validator and can be revalidated
+         */
+        bool canRevalidate() const { return !mETag.empty() || !mLastModified.empty(); }
+
+        /**
+         * @return the number of bytes the entry occupies in memory
+         */
+        size_t getSize() const { return (mData != nullptr ? mData->size() : 0) + mContentType.size() + mETag.size() + mLastModified.size(); }
+    };
+
+
+    /**
+     * Response cache shared by one or more RestClients, honors Cache-Control, ETag and Last-Modified.
+     * Entries live in an in-memory LRU, bounded by MaxMemorySize, and optionally in a directory on disk, bounded by MaxDiskSize.
+     * Entries that are no longer in memory are loaded from disk on lookup.
+     * Fresh entries are served without a network round trip, stale entries are revalidated by the client.
+     * Only successful (200) GET responses that carry a max-age, an Expires date or a validator are stored, no-store responses are never stored.
+     * max-age takes precedence over Expires. Cached bodies are shared with the responses they complete, not copied.
+     * All functions are thread safe, entries are stored and looked up from the client worker threads.
+     */
+    class NAPAPI RestCache : public Resource
+    {
+    RTTI_ENABLE(Resource)
+    public:
+        /**
+         * Creates the cache directory and loads the size of the entries stored on disk
+         * @param errorState contains the error state
+         * @return true on success
+         */
+        bool init(utility::ErrorState& errorState) override;
+
+        /**
+         * Finds an entry in memory, or on disk when the disk tier is enabled
+         * @param key the url of the request, including the query
+         * @return the entry, nullptr if not cached
+         */
+        std::shared_ptr<const RestCacheEntry> find(const std::string& key);
+
+        /**
+         * Stores a response when its Cache-Control and validators allow it, the body is moved into the cache
+         * @param key the url of the request, including the query
+         * @param response the response to store
+         * @return the stored entry, nullptr if the response can't be cached, in which case the body is not moved
+         */
+        std::shared_ptr<const RestCacheEntry> store(const std::string& key, httplib::Response& response);
+
+        /**
+         * Refreshes an entry after the upstream answered a revalidation with 304 Not Modified.
+         * The body of the cached entry is reused, its freshness and validators are updated from the 304 response.
+         * @param key the url of the request, including the query
+         * @param entry the entry that was revalidated
+         * @param response the 304 response
+         * @return the refreshed entry
+         */
+        std::shared_ptr<const RestCacheEntry> refresh(const std::string& key, const RestCacheEntry& entry, const httplib::Response& response);
+
+        /**
+         * Removes an entry from memory and disk, called when a request changed the resource
+         * @param key the url of the request, including the query
+         */
+        void remove(const std::string& key);
+
+        /**
+         * Removes all entries from memory and disk
+         */
+        void clear();
+
+        /**
+         * @return number of requests served from the cache without a network round trip
+         */
+        uint64_t getHitCount() const { return mHitCount.load(); }
+
+        /**
+         * @return number of stale entries the upstream confirmed with 304 Not Modified
+         */
+        uint64_t getRevalidatedCount() const { return mRevalidatedCount.load(); }
+
+        /**
+         * @return number of requests that were not cached or had to be fetched again
+         */
+        uint64_t getMissCount() const { return mMissCount.load(); }
+
+        int mMaxMemorySize = 32 * 1024 * 1024; ///< Property : 'MaxMemorySize' Maximum number of bytes kept in memory, least recently used entries are evicted first
+        std::string mDirectory; ///< Property : 'Directory' Directory of the disk tier, leave empty to only cache in memory
+        int mMaxDiskSize = 256 * 1024 * 1024; ///< Property : 'MaxDiskSize' Maximum number of bytes stored on disk, oldest entries are removed first
+
+    private:
+        friend class RestClient;
+
+        using LRUList = std::list<std::pair<std::string, std::shared_ptr<const RestCacheEntry>>>;
+
+        // Adds or replaces an entry in memory, evicts the least recently used entries
+        void insert(const std::string& key, std::shared_ptr<const RestCacheEntry> entry);
+
+        // Disk tier
+        std::string getPath(const std::string& key) const;
+        std::shared_ptr<const RestCacheEntry> read(const std::string& key);
+        void write(const std::string& key, const RestCacheEntry& entry);
+        void trimDisk();
+
+        std::mutex mMutex;                                          ///< Guards the memory tier
+        LRUList mEntries;                                           ///< Most recently used first
+        std::unordered_map<std::string, LRUList::iterator> mIndex;
+        size_t mMemorySize = 0;
+
+        std::mutex mDiskMutex;                                      ///< Serializes disk writes and trimming
+        uint64_t mDiskSize = 0;
+
+        std::atomic<uint64_t> mHitCount = {0};
+        std::atomic<uint64_t> mRevalidatedCount = {0};
+        std::atomic<uint64_t> mMissCount = {0};
+    };
+}
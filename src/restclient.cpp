@@ -1,9 +1,18 @@
 #include "restclient.h"
 #include "restservice.h"
 #include "httplibwrapper.h"
+#include "restpipeline.h"
+#include "restdownload.h"
+#include "restjson.h"
 #include "nap/logger.h"
 
-#include <mathutils.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <random>
 
 RTTI_BEGIN_CLASS_NO_DEFAULT_CONSTRUCTOR(nap::RestClient)
     RTTI_CONSTRUCTOR(nap::RestService&)
@@ -12,245 +21,2046 @@ RTTI_BEGIN_CLASS_NO_DEFAULT_CONSTRUCTOR(nap::RestClient)
     RTTI_PROPERTY("ArraySeparator", &nap::RestClient::mArraySeparator, nap::rtti::EPropertyMetaData::Default, "The separator used for arrays of parameters in the URL")
     RTTI_PROPERTY("Headers", &nap::RestClient::mHeaders, nap::rtti::EPropertyMetaData::Default, "The headers to send with the request")
     RTTI_PROPERTY("Timeout", &nap::RestClient::mTimeOutSeconds, nap::rtti::EPropertyMetaData::Default, "The timeout in seconds for the request")
+    RTTI_PROPERTY("Connections", &nap::RestClient::mConnections, nap::rtti::EPropertyMetaData::Default, "The number of connections, each connection has its own worker thread")
+    RTTI_PROPERTY("KeepAlive", &nap::RestClient::mKeepAlive, nap::rtti::EPropertyMetaData::Default, "Keep connections open between requests")
+    RTTI_PROPERTY("IdleTimeout", &nap::RestClient::mIdleTimeOutSeconds, nap::rtti::EPropertyMetaData::Default, "Connections idle for longer than this number of seconds are reopened, 0 means never")
+    RTTI_PROPERTY("WarmUp", &nap::RestClient::mWarmUp, nap::rtti::EPropertyMetaData::Default, "Open all connections when the client starts")
+    RTTI_PROPERTY("WarmUpAddress", &nap::RestClient::mWarmUpAddress, nap::rtti::EPropertyMetaData::Default, "The address of the HEAD request used to warm up the connections")
+    RTTI_PROPERTY("Pipelining", &nap::RestClient::mPipelining, nap::rtti::EPropertyMetaData::Default, "Write multiple queued requests back to back on a connection, plain http only")
+    RTTI_PROPERTY("PipelineDepth", &nap::RestClient::mPipelineDepth, nap::rtti::EPropertyMetaData::Default, "The maximum number of requests written back to back on a connection")
+    RTTI_PROPERTY("Deduplicate", &nap::RestClient::mDeduplicate, nap::rtti::EPropertyMetaData::Default, "Attach requests to an identical request that is queued or in flight")
+    RTTI_PROPERTY("Retry", &nap::RestClient::mRetry, nap::rtti::EPropertyMetaData::Default, "When and how often failed requests are sent again")
+    RTTI_PROPERTY("CircuitBreaker", &nap::RestClient::mCircuitBreaker, nap::rtti::EPropertyMetaData::Default, "Fails requests right away while the upstream keeps failing")
+    RTTI_PROPERTY("Hedge", &nap::RestClient::mHedge, nap::rtti::EPropertyMetaData::Default, "Sends a duplicate of requests that are slower than usual")
+    RTTI_PROPERTY("Cache", &nap::RestClient::mCache, nap::rtti::EPropertyMetaData::Default, "Optional response cache")
+    RTTI_PROPERTY("Compression", &nap::RestClient::mCompression, nap::rtti::EPropertyMetaData::Default, "Ask the upstream for compressed responses")
+    RTTI_PROPERTY("CompressionThreshold", &nap::RestClient::mCompressionThreshold, nap::rtti::EPropertyMetaData::Default, "Request bodies of at least this number of bytes are sent compressed, 0 disables request compression")
 RTTI_END_CLASS
 
+RTTI_BEGIN_ENUM(nap::ERestCallbackExecutor)
+    RTTI_ENUM_VALUE(nap::ERestCallbackExecutor::MainThread, "MainThread"),
+    RTTI_ENUM_VALUE(nap::ERestCallbackExecutor::Worker, "Worker"),
+    RTTI_ENUM_VALUE(nap::ERestCallbackExecutor::Custom, "Custom")
+RTTI_END_ENUM
+
+RTTI_BEGIN_ENUM(nap::ERestRequestPriority)
+    RTTI_ENUM_VALUE(nap::ERestRequestPriority::Low, "Low"),
+    RTTI_ENUM_VALUE(nap::ERestRequestPriority::Normal, "Normal"),
+    RTTI_ENUM_VALUE(nap::ERestRequestPriority::High, "High")
+RTTI_END_ENUM
+
+RTTI_BEGIN_STRUCT(nap::RestRequestOptions)
+    RTTI_PROPERTY("Ordered", &nap::RestRequestOptions::mOrdered, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Executor", &nap::RestRequestOptions::mExecutor, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Priority", &nap::RestRequestOptions::mPriority, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_STRUCT
+
+RTTI_BEGIN_STRUCT(nap::RestRetryPolicy)
+    RTTI_PROPERTY("MaxAttempts", &nap::RestRetryPolicy::mMaxAttempts, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("InitialDelay", &nap::RestRetryPolicy::mInitialDelay, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("MaxDelay", &nap::RestRetryPolicy::mMaxDelay, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Multiplier", &nap::RestRetryPolicy::mMultiplier, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Jitter", &nap::RestRetryPolicy::mJitter, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("StatusCodes", &nap::RestRetryPolicy::mStatusCodes, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("ConnectionErrors", &nap::RestRetryPolicy::mConnectionErrors, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("TransferErrors", &nap::RestRetryPolicy::mTransferErrors, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_STRUCT
+
+RTTI_BEGIN_STRUCT(nap::RestCircuitBreakerPolicy)
+    RTTI_PROPERTY("Enabled", &nap::RestCircuitBreakerPolicy::mEnabled, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("FailureThreshold", &nap::RestCircuitBreakerPolicy::mFailureThreshold, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("OpenDuration", &nap::RestCircuitBreakerPolicy::mOpenDuration, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("ProbeCount", &nap::RestCircuitBreakerPolicy::mProbeCount, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_STRUCT
+
+RTTI_BEGIN_STRUCT(nap::RestHedgePolicy)
+    RTTI_PROPERTY("Enabled", &nap::RestHedgePolicy::mEnabled, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Percentile", &nap::RestHedgePolicy::mPercentile, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("MinDelay", &nap::RestHedgePolicy::mMinDelay, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("MaxRate", &nap::RestHedgePolicy::mMaxRate, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Window", &nap::RestHedgePolicy::mWindow, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("MinSamples", &nap::RestHedgePolicy::mMinSamples, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_STRUCT
+
+RTTI_BEGIN_ENUM(nap::ERestCircuitState)
+    RTTI_ENUM_VALUE(nap::ERestCircuitState::Closed, "Closed"),
+    RTTI_ENUM_VALUE(nap::ERestCircuitState::Open, "Open"),
+    RTTI_ENUM_VALUE(nap::ERestCircuitState::HalfOpen, "HalfOpen")
+RTTI_END_ENUM
+
 RTTI_BEGIN_STRUCT(nap::RestHeader)
     RTTI_PROPERTY("Key", &nap::RestHeader::key, nap::rtti::EPropertyMetaData::Default)
     RTTI_PROPERTY("Value", &nap::RestHeader::value, nap::rtti::EPropertyMetaData::Default)
 RTTI_END_STRUCT
 
-namespace nap
-{
-    ////////////////////////////////////////////////////////////////////////////
-    //// Helper functions forwarded declarations
-    ////////////////////////////////////////////////////////////////////////////
+namespace nap
+{
+    ////////////////////////////////////////////////////////////////////////////
+    //// Helper functions forwarded declarations
+    ////////////////////////////////////////////////////////////////////////////
+
+    static httplib::Params toHTTPParams(const std::vector<std::unique_ptr<APIBaseValue>> &params, const std::string& arraySeparator);
+
+    static httplib::Headers toHTTPHeaders(const std::vector<RestHeader>& headers);
+
+    static std::string toHTTPTarget(const std::string& address, const httplib::Params& params);
+
+    static void configure(httplib::Client& client, const std::string& certPath, int timeOutSeconds, bool keepAlive);
+
+    static void toRestResponse(httplib::Response& response, RestCache* cache, const std::string& cacheKey, RestResponse& output);
+
+    static httplib::Result sendBody(httplib::Client& client, const std::string& method, const std::string& target, httplib::Headers headers, const RestRequestBody& body,
+                                    int compressionThreshold, const std::function<bool()>& isAbandoned, uint64_t& contentSize, uint64_t& wireSize);
+
+    static uint64_t getWireSize(const httplib::Response& response, uint64_t contentSize);
+
+    // Content codings httplib decodes, depends on the libraries the module is built with
+    static const char* sAcceptEncoding =
+#if defined(CPPHTTPLIB_BROTLI_SUPPORT) && defined(CPPHTTPLIB_ZLIB_SUPPORT)
+        "br, gzip, deflate";
+#elif defined(CPPHTTPLIB_BROTLI_SUPPORT)
+        "br";
+#elif defined(CPPHTTPLIB_ZLIB_SUPPORT)
+        "gzip, deflate";
+#else
+        "identity";
+#endif
+
+    // Number of bytes a download writes before its progress is stored again
+    static constexpr uint64_t sDownloadSaveInterval = 4 * 1024 * 1024;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestClient::Connection
+    ////////////////////////////////////////////////////////////////////////////
+
+    struct RestClient::Connection
+    {
+        Connection(const std::string &url, int index) : mClient(url), mIndex(index)
+        {}
+
+        httplib::Client mClient;
+        int mIndex;                         ///< The first connection also handles ordered requests
+        std::mutex mMutex;                  ///< Guards the client, which is also used by blocking calls
+        std::chrono::steady_clock::time_point mLastUsed;   ///< When the last request on this connection finished
+        utility::AutoResetEvent mEvent;     ///< Set when a request is available for this connection
+        std::thread mThread;
+        std::unique_ptr<RestPipeline> mPipeline;    ///< Only created when pipelining is enabled
+
+        // Hedging, only created when hedging is enabled, the hedge thread sends the duplicate of a slow request
+        enum class EHedgeState { Idle, Armed, Sending, Done };
+        std::unique_ptr<httplib::Client> mHedgeClient;
+        std::thread mHedgeThread;
+        std::mutex mHedgeMutex;             ///< Guards the hedge state below
+        std::condition_variable mHedgeCondition;
+        EHedgeState mHedgeState = EHedgeState::Idle;
+        std::string mHedgeTarget;
+        httplib::Headers mHedgeHeaders;
+        std::chrono::steady_clock::time_point mHedgeDeadline;
+        httplib::Result mHedgeResult;
+        std::atomic_bool mHedgeCancelled = { false };
+        std::atomic<int> mWinner = { 0 };   ///< 0 while undecided, 1 when the original request won, 2 when the hedge won
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestRequestHandle
+    ////////////////////////////////////////////////////////////////////////////
+
+    struct RestRequestHandle::State
+    {
+        std::atomic_bool mCancelled = { false };
+        std::atomic<int> mDependents = { 0 };       ///< Identical requests attached to the request, they keep it going when it is cancelled
+        std::mutex mMutex;                          ///< Guards the clients and pipelines
+        std::vector<httplib::Client*> mClients;     ///< Clients that are sending the request, stopped to abort it
+        std::vector<RestPipeline*> mPipelines;      ///< Pipelines that are sending the request, aborted when none of their requests is needed anymore
+        std::shared_ptr<State> mLeader;             ///< State of the identical request this request is attached to, set before the handle is returned
+
+        // Returns true when the request is cancelled and no attached request needs its response
+        bool isAbandoned() const
+        {
+            return mCancelled.load() && mDependents.load() == 0;
+        }
+
+        // Removes an attached request, aborts the request when it is cancelled and this was the last request that needed its response
+        void removeDependent()
+        {
+            if(--mDependents == 0 && mCancelled.load())
+                abort();
+        }
+
+        // Aborts the request when it is being sent
+        void abort()
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for(auto* client : mClients)
+                client->stop();
+            for(auto* pipeline : mPipelines)
+                pipeline->abort();
+        }
+    };
+
+
+    void RestRequestHandle::cancel()
+    {
+        if(mState == nullptr || mState->mCancelled.exchange(true))
+            return;
+
+        // The request it is attached to no longer needs to be sent for this request
+        if(mState->mLeader != nullptr)
+            mState->mLeader->removeDependent();
+
+        if(mState->isAbandoned())
+            mState->abort();
+    }
+
+
+    bool RestRequestHandle::isCancelled() const
+    {
+        return mState != nullptr && mState->mCancelled.load();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestClient::Request
+    ////////////////////////////////////////////////////////////////////////////
+
+    struct RestClient::Request
+    {
+        std::string mTarget;                ///< The address including the encoded query
+        std::function<void(const RestResponse&)> mOnSuccess;
+        std::function<void(const utility::ErrorState&)> mOnError;
+        ERestCallbackExecutor mExecutor = ERestCallbackExecutor::MainThread;
+        RestExecutor mCustomExecutor;
+        RestResponse mResponse;
+        utility::ErrorState mErrorState;
+        bool mSuccess = false;
+
+        // Outcome of the last attempt, used by the retry policy and circuit breaker
+        int mStatus = 0;
+        httplib::Error mError = httplib::Error::Success;
+        int mRetryAfter = -1;               ///< Seconds the upstream asked to wait before retrying, -1 if not given
+        bool mFromCache = false;            ///< Set when the last attempt was served from the cache without a network round trip
+        std::shared_ptr<const RestCacheEntry> mCached; ///< Entry found before the request was sent, used by the next attempt instead of looking it up again
+
+        // Returns true when the last attempt was answered with a status the policy retries
+        bool hasRetryableStatus(const RestRetryPolicy& policy) const
+        {
+            return mStatus > 0 && std::find(policy.mStatusCodes.begin(), policy.mStatusCodes.end(), mStatus) != policy.mStatusCodes.end();
+        }
+
+        // Returns true when the last attempt failed in a way the policy retries
+        bool isRetryable(const RestRetryPolicy& policy) const
+        {
+            switch(mError)
+            {
+            case httplib::Error::Success:
+                return hasRetryableStatus(policy);
+            case httplib::Error::Connection:
+            case httplib::Error::ConnectionTimeout:
+            case httplib::Error::SSLConnection:
+            case httplib::Error::ProxyConnection:
+                return policy.mConnectionErrors;
+            case httplib::Error::Read:
+            case httplib::Error::Write:
+                return policy.mTransferErrors;
+            default:
+                return false;
+            }
+        }
+
+        // Clears the outcome of the last attempt
+        void reset()
+        {
+            mResponse = RestResponse();
+            mErrorState = utility::ErrorState();
+            mStatus = 0;
+            mError = httplib::Error::Success;
+            mRetryAfter = -1;
+            mFromCache = false;
+        }
+
+        // Identical requests made while this request is queued or in flight, guarded by the pending mutex
+        bool mShared = false;
+        std::vector<std::unique_ptr<Request>> mFollowers;
+
+        // Cancellation state shared with the handle returned to the caller, not set for blocking requests
+        std::shared_ptr<RestRequestHandle::State> mState;
+        ERestRequestPriority mPriority = ERestRequestPriority::Normal;
+
+        // Receives the body of streamed requests
+        RestContentReceiver mReceiver;
+        uint64_t mStreamedBytes = 0;
+        bool mStopped = false;              ///< Set by the receiver when it needs no more data, the transfer ends early and succeeds
+
+        bool isStreamed() const
+        {
+            return mReceiver != nullptr;
+        }
+
+        // The method, headers sent on top of the client headers and a handler that inspects the response before the body is received
+        std::string mMethod = "GET";
+        httplib::Headers mHeaders;
+        httplib::ResponseHandler mResponseHandler;
+
+        // Called on the worker once the request is sent or dropped, instead of handing it to its executor, used by the requests of a download
+        std::function<void(Request&)> mOnSent;
+
+        // Called on the worker with the response of a successful request before it is handed to its executor, parses the body off the main thread
+        // Fails the request by clearing the success flag and filling the error state
+        std::function<void(Request&)> mOnReceived;
+
+        // Returns true for plain get requests with a buffered body, the only requests that are cached, hedged, pipelined and deduplicated
+        bool isSimple() const
+        {
+            return mMethod == "GET" && !isStreamed() && mHeaders.empty();
+        }
+
+        // Body of post, put and patch requests
+        RestRequestBody mBody;
+
+        // Returns true when sending the request again has the same effect as sending it once, only those requests are retried
+        // Streamed bodies can't be provided twice
+        bool isIdempotent() const
+        {
+            return (mMethod == "GET" || mMethod == "HEAD" || mMethod == "PUT" || mMethod == "DELETE") && !mBody.isStreamed();
+        }
+
+        bool isCancelled() const
+        {
+            return mState != nullptr && mState->mCancelled.load();
+        }
+
+        bool isAbandoned() const
+        {
+            return mState != nullptr && mState->isAbandoned();
+        }
+
+        // Registers the clients that send the request, cancelling the request stops them
+        // The segments of a download share their state, only the clients of this request are replaced
+        void setClients(std::vector<httplib::Client*> clients)
+        {
+            if(mState == nullptr)
+                return;
+            clients.erase(std::remove(clients.begin(), clients.end(), nullptr), clients.end());
+            std::lock_guard<std::mutex> lock(mState->mMutex);
+            auto& registered = mState->mClients;
+            for(auto* client : mClients)
+            {
+                auto it = std::find(registered.begin(), registered.end(), client);
+                if(it != registered.end())
+                    registered.erase(it);
+            }
+            registered.insert(registered.end(), clients.begin(), clients.end());
+            mClients = std::move(clients);
+        }
+        std::vector<httplib::Client*> mClients;
+
+        // Registers the pipeline that sends the request, nullptr when the request is no longer sent
+        void setPipeline(RestPipeline* pipeline)
+        {
+            if(mState == nullptr)
+                return;
+            std::lock_guard<std::mutex> lock(mState->mMutex);
+            auto& registered = mState->mPipelines;
+            auto it = std::find(registered.begin(), registered.end(), mPipeline);
+            if(it != registered.end())
+                registered.erase(it);
+            if(pipeline != nullptr)
+                registered.emplace_back(pipeline);
+            mPipeline = pipeline;
+        }
+        RestPipeline* mPipeline = nullptr;
+
+        // Calls the success or error callback, unless the request is cancelled
+        void complete()
+        {
+            if(isCancelled())
+                return;
+
+            if(mSuccess)
+                mOnSuccess(mResponse);
+            else
+                mOnError(mErrorState);
+        }
+
+        // Latest progress, written by the worker and sampled by the main thread once per update
+        std::atomic<uint64_t> mProgressCurrent = { 0 };
+        std::atomic<uint64_t> mProgressTotal = { 0 };
+        std::atomic_bool mProgressChanged = { false };
+
+        // Stores the latest progress, called from the worker
+        void setProgress(uint64_t current, uint64_t total)
+        {
+            mProgressCurrent.store(current, std::memory_order_relaxed);
+            mProgressTotal.store(total, std::memory_order_relaxed);
+            mProgressChanged.store(true, std::memory_order_release);
+        }
+
+        // Returns true and the latest progress when it changed since the last call
+        bool takeProgress(uint64_t& current, uint64_t& total)
+        {
+            if(!mProgressChanged.exchange(false, std::memory_order_acquire))
+                return false;
+            current = mProgressCurrent.load(std::memory_order_relaxed);
+            total = mProgressTotal.load(std::memory_order_relaxed);
+            return true;
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestClient::Task
+    ////////////////////////////////////////////////////////////////////////////
+
+    struct RestClient::Task
+    {
+        virtual ~Task() = default;
+        virtual void run() = 0;
+
+        // Wraps a callable, the callable is moved into the task and never copied
+        template<typename F>
+        static std::unique_ptr<Task> create(F function)
+        {
+            struct Callable final : public Task
+            {
+                Callable(F&& function) : mFunction(std::move(function)) { }
+                void run() override { mFunction(); }
+                F mFunction;
+            };
+            return std::make_unique<Callable>(std::move(function));
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestClient::Download
+    ////////////////////////////////////////////////////////////////////////////
+
+    struct RestClient::Download
+    {
+        Download(const std::string& path) : mFile(path)
+        {}
+
+        RestDownloadFile mFile;
+        std::string mTarget;                ///< The address including the encoded query
+        RestDownloadOptions mOptions;
+        std::function<void(const RestDownloadResult&)> mOnSuccess;
+        std::function<void(const utility::ErrorState&)> mOnError;
+        std::shared_ptr<RestRequestHandle::State> mState;  ///< Shared by the probe and all segments, cancelling the download aborts them all
+
+        // The file as described by the upstream in response to the probe
+        uint64_t mSize = 0;
+        bool mRanges = false;               ///< If the upstream accepts Range requests
+        std::string mValidator;             ///< Strong ETag or Last-Modified, sent as If-Range so a changed file is never stitched together
+        std::string mContentType;
+
+        // Outcome of the segments
+        std::mutex mMutex;                  ///< Guards the error state and remaining segments
+        utility::ErrorState mErrorState;
+        int mRemaining = 0;                 ///< Segments that are queued or in flight
+        std::atomic_bool mFailed = { false };
+        std::atomic_bool mChanged = { false };          ///< The file changed on the upstream, the partial file can't be resumed
+        std::atomic<uint64_t> mUnsavedBytes = { 0 };    ///< Bytes written since the progress was last stored
+
+        // Records the first error, the remaining segments stop at their next chunk
+        void fail(const std::string& error)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(!mFailed.exchange(true))
+                mErrorState.fail("%s", error.c_str());
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestClient::Batch
+    ////////////////////////////////////////////////////////////////////////////
+
+    struct RestClient::Batch
+    {
+        std::vector<std::string> mTargets;  ///< The addresses including the encoded query, in order of the requests
+        RestBatchOptions mOptions;
+        std::function<void(const std::vector<RestBatchResult>&)> mOnComplete;
+        std::shared_ptr<RestRequestHandle::State> mState;  ///< Shared by all requests, cancelling the batch cancels them all
+        std::chrono::steady_clock::time_point mStart;
+
+        // Results of the requests, in order of the requests
+        std::mutex mMutex;                  ///< Guards the results and the counters
+        std::vector<RestBatchResult> mResults;
+        size_t mNext = 0;                   ///< Index of the next request to queue
+        size_t mRemaining = 0;              ///< Requests that did not complete yet
+
+        // Milliseconds since the batch was made
+        float getElapsed() const
+        {
+            return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - mStart).count();
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestClient::Impl
+    ////////////////////////////////////////////////////////////////////////////
+
+    struct RestClient::Impl
+    {
+        std::vector<std::unique_ptr<Connection>> mConnections;
+
+        // Requests that are currently being sent, sampled for progress on the main thread
+        std::mutex mInFlightMutex;
+        std::vector<Request*> mInFlight;
+
+        // Memory JSON responses are parsed into, outlives the client while parsed documents wait for completion
+        std::shared_ptr<RestJsonPool> mJsonPool = std::make_shared<RestJsonPool>();
+
+        // Requests that are queued or in flight by target, identical requests attach to them
+        std::mutex mPendingMutex;
+        std::unordered_map<std::string, Request*> mPending;
+
+        // Headers of the client appended to every cache key, clients that share a cache but send different headers get different responses
+        std::string mCacheKeyHeaders;
+
+        // Removes the request from the pending requests, unless an identical request took its place, must hold the pending mutex
+        void erasePending(Request& request)
+        {
+            auto it = mPending.find(request.mTarget);
+            if(it != mPending.end() && it->second == &request)
+                mPending.erase(it);
+            request.mShared = false;
+        }
+
+        // Returns true when a queued request is cancelled, and so are all requests attached to it, it is dropped without being sent
+        bool drop(Request& request)
+        {
+            if(!request.isCancelled())
+                return false;
+
+            std::lock_guard<std::mutex> lock(mPendingMutex);
+            if(std::any_of(request.mFollowers.begin(), request.mFollowers.end(), [](const auto& follower) { return !follower->isCancelled(); }))
+                return false;
+            erasePending(request);
+            return true;
+        }
+
+        void addInFlight(Request& request)
+        {
+            std::lock_guard<std::mutex> lock(mInFlightMutex);
+            mInFlight.emplace_back(&request);
+        }
+
+        void removeInFlight(Request& request)
+        {
+            std::lock_guard<std::mutex> lock(mInFlightMutex);
+            auto it = std::find(mInFlight.begin(), mInFlight.end(), &request);
+            if(it != mInFlight.end())
+                mInFlight.erase(it);
+        }
+
+        // Wakes up workers that wait before retrying when the client stops
+        std::mutex mStopMutex;
+        std::condition_variable mStopCondition;
+
+        // Recently observed latencies in milliseconds and the hedge budget
+        mutable std::mutex mLatencyMutex;
+        std::vector<float> mLatencies;
+        size_t mLatencyIndex = 0;
+        float mHedgeTokens = 0.0f;
+        uint64_t mHedgeableCount = 0;
+
+        // The percentile of the latencies, recomputed once enough new latencies were recorded
+        std::vector<float> mSortedLatencies;
+        float mLatencyPercentile = 0.0f;
+        size_t mNewLatencies = 0;           ///< Latencies recorded since the percentile was computed
+        bool mHasPercentile = false;
+
+        // Records the latency of a completed request
+        void addLatency(const RestHedgePolicy& policy, float latency)
+        {
+            std::lock_guard<std::mutex> lock(mLatencyMutex);
+            mNewLatencies++;
+            size_t window = static_cast<size_t>(std::max(policy.mWindow, 1));
+            if(mLatencies.size() < window)
+            {
+                mLatencies.emplace_back(latency);
+                return;
+            }
+            mLatencyIndex = mLatencyIndex % window;
+            mLatencies[mLatencyIndex++] = latency;
+        }
+
+        // Returns true and the delay after which a new request is hedged, adds the share of the request to the hedge budget
+        bool getHedgeDelay(const RestHedgePolicy& policy, float& delay)
+        {
+            std::lock_guard<std::mutex> lock(mLatencyMutex);
+            mHedgeableCount++;
+            mHedgeTokens = std::min(mHedgeTokens + std::clamp(policy.mMaxRate, 0.0f, 1.0f), 1.0f);
+            if(mLatencies.empty() || mLatencies.size() < static_cast<size_t>(policy.mMinSamples))
+                return false;
+
+            // Selecting the percentile copies the window, only do so after a 16th of the window was replaced
+            size_t interval = std::max<size_t>(static_cast<size_t>(std::max(policy.mWindow, 1)) / 16, 1);
+            if(!mHasPercentile || mNewLatencies >= interval)
+            {
+                mSortedLatencies.assign(mLatencies.begin(), mLatencies.end());
+                auto nth = static_cast<size_t>(std::clamp(policy.mPercentile, 0.0f, 100.0f) / 100.0f * static_cast<float>(mSortedLatencies.size() - 1));
+                std::nth_element(mSortedLatencies.begin(), mSortedLatencies.begin() + nth, mSortedLatencies.end());
+                mLatencyPercentile = mSortedLatencies[nth];
+                mNewLatencies = 0;
+                mHasPercentile = true;
+            }
+            delay = std::max(mLatencyPercentile, static_cast<float>(policy.mMinDelay));
+            return true;
+        }
+
+        // Takes a hedge from the budget, returns false when the hedge rate would be exceeded
+        bool takeHedgeToken()
+        {
+            std::lock_guard<std::mutex> lock(mLatencyMutex);
+            if(mHedgeTokens < 1.0f)
+                return false;
+            mHedgeTokens -= 1.0f;
+            return true;
+        }
+
+        // Circuit breaker
+        mutable std::mutex mCircuitMutex;
+        ERestCircuitState mCircuitState = ERestCircuitState::Closed;
+        int mFailures = 0;                  ///< Consecutive failures while closed
+        int mProbes = 0;                    ///< Requests let through while half open
+        std::chrono::steady_clock::time_point mOpenUntil;
+
+        // Returns true when a request may be sent, starts probing when the circuit has been open long enough
+        bool acquire(const RestCircuitBreakerPolicy& policy)
+        {
+            if(!policy.mEnabled)
+                return true;
+
+            std::lock_guard<std::mutex> lock(mCircuitMutex);
+            if(mCircuitState == ERestCircuitState::Closed)
+                return true;
+
+            if(mCircuitState == ERestCircuitState::Open)
+            {
+                if(std::chrono::steady_clock::now() < mOpenUntil)
+                    return false;
+                mCircuitState = ERestCircuitState::HalfOpen;
+                mProbes = 0;
+            }
+
+            if(mProbes >= policy.mProbeCount)
+                return false;
+            mProbes++;
+            return true;
+        }
+
+        // Returns true when new requests would be rejected, without taking a probe
+        bool isRejecting(const RestCircuitBreakerPolicy& policy) const
+        {
+            if(!policy.mEnabled)
+                return false;
+
+            std::lock_guard<std::mutex> lock(mCircuitMutex);
+            switch(mCircuitState)
+            {
+            case ERestCircuitState::Open:
+                return std::chrono::steady_clock::now() < mOpenUntil;
+            case ERestCircuitState::HalfOpen:
+                return mProbes >= policy.mProbeCount;
+            default:
+                return false;
+            }
+        }
+
+        // Returns a probe taken by a request that ended without reaching the upstream
+        void release(const RestCircuitBreakerPolicy& policy)
+        {
+            if(!policy.mEnabled)
+                return;
+
+            std::lock_guard<std::mutex> lock(mCircuitMutex);
+            if(mCircuitState == ERestCircuitState::HalfOpen && mProbes > 0)
+                mProbes--;
+        }
+
+        // Records the outcome of a request, opens the circuit after too many failures or a failed probe
+        void report(const RestCircuitBreakerPolicy& policy, bool healthy)
+        {
+            if(!policy.mEnabled)
+                return;
+
+            std::lock_guard<std::mutex> lock(mCircuitMutex);
+            if(healthy)
+            {
+                mCircuitState = ERestCircuitState::Closed;
+                mFailures = 0;
+                return;
+            }
+
+            // Requests that were sent before the circuit opened don't extend the open period
+            if(mCircuitState == ERestCircuitState::Open)
+                return;
+
+            if(mCircuitState == ERestCircuitState::HalfOpen || ++mFailures >= policy.mFailureThreshold)
+            {
+                mCircuitState = ERestCircuitState::Open;
+                mOpenUntil = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(policy.mOpenDuration));
+                mFailures = 0;
+            }
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestClient
+    ////////////////////////////////////////////////////////////////////////////
+
+    RestClient::RestClient(RestService &service) : mService(service)
+    {}
+
+
+    RestClient::~RestClient()
+    {}
+
+
+    bool RestClient::init(nap::utility::ErrorState &errorState)
+    {
+        if(!errorState.check(mConnections > 0, "%s: number of connections must be at least 1", mID.c_str()))
+            return false;
+
+#ifndef CPPHTTPLIB_ZLIB_SUPPORT
+        if(mCompressionThreshold > 0)
+            nap::Logger::warn(*this, "Request compression requires zlib, request bodies are sent uncompressed");
+#endif
+
+        // Pipelining requires a plain http connection to a known host and port
+        std::string pipeline_host;
+        int pipeline_port = 0;
+        bool pipelining = mPipelining && mKeepAlive && mPipelineDepth > 1;
+        if(pipelining && !RestPipeline::parseURL(mURL, pipeline_host, pipeline_port))
+        {
+            nap::Logger::warn(*this, "Pipelining is only supported for plain http URLs, disabling pipelining");
+            pipelining = false;
+        }
+
+        mImpl = std::make_unique<Impl>();
+        for(int i = 0; i < mConnections; i++)
+        {
+            auto connection = std::make_unique<Connection>(mURL, i);
+            configure(connection->mClient, mCertPath, mTimeOutSeconds, mKeepAlive);
+            if(mHedge.mEnabled)
+            {
+                connection->mHedgeClient = std::make_unique<httplib::Client>(mURL);
+                configure(*connection->mHedgeClient, mCertPath, mTimeOutSeconds, mKeepAlive);
+            }
+            if(pipelining)
+                connection->mPipeline = std::make_unique<RestPipeline>(pipeline_host, pipeline_port, mTimeOutSeconds);
+            mImpl->mConnections.emplace_back(std::move(connection));
+        }
+
+        // Sorted by lower case key, clients that send the same headers in a different order share entries
+        std::vector<std::string> cache_key_headers;
+        for(const auto& header : mHeaders)
+        {
+            std::string key = header.key;
+            std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            cache_key_headers.emplace_back(key + ": " + header.value);
+        }
+        std::sort(cache_key_headers.begin(), cache_key_headers.end());
+        for(const auto& header : cache_key_headers)
+            mImpl->mCacheKeyHeaders += " " + header;
+
+        return true;
+    }
+
+
+    bool RestClient::start(nap::utility::ErrorState &errorState)
+    {
+        mService.registerRestClient(*this);
+
+        mRunning = true;
+        for(auto& connection : mImpl->mConnections)
+        {
+            connection->mThread = std::thread(&RestClient::run, this, std::ref(*connection));
+            if(connection->mHedgeClient != nullptr)
+                connection->mHedgeThread = std::thread(&RestClient::runHedge, this, std::ref(*connection));
+        }
+        return true;
+    }
+
+
+    void RestClient::stop()
+    {
+        mService.removeRestClient(*this);
+
+        mRunning = false;
+        for(auto& connection : mImpl->mConnections)
+            connection->mEvent.cancelWait();
+        {
+            std::lock_guard<std::mutex> lock(mImpl->mStopMutex);
+            mImpl->mStopCondition.notify_all();
+        }
+
+        for(auto& connection : mImpl->mConnections)
+        {
+            if(connection->mHedgeClient == nullptr)
+                continue;
+            {
+                std::lock_guard<std::mutex> lock(connection->mHedgeMutex);
+                connection->mHedgeCancelled = true;
+                connection->mHedgeCondition.notify_all();
+            }
+            connection->mHedgeClient->stop();
+        }
+
+        for(auto& connection : mImpl->mConnections)
+        {
+            connection->mThread.join();
+            connection->mClient.stop();
+            if(connection->mHedgeThread.joinable())
+                connection->mHedgeThread.join();
+        }
+    }
+
+
+    bool RestClient::getBlocking(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, nap::RestResponse &response, utility::ErrorState &errorState)
+    {
+        Request request;
+        request.mTarget = toHTTPTarget(address, toHTTPParams(params, mArraySeparator));
+        bool success = perform(*mImpl->mConnections.front(), request);
+        flushProgress(request);
+        if(!success)
+        {
+            errorState = std::move(request.mErrorState);
+            return false;
+        }
+
+        response = std::move(request.mResponse);
+        return true;
+    }
+
+
+    bool RestClient::send(Connection& connection, Request& request)
+    {
+        auto httplib_headers = toHTTPHeaders(mHeaders);
+        httplib_headers.insert(request.mHeaders.begin(), request.mHeaders.end());
+
+        // httplib asks for every coding it can decode, unless told otherwise or the body is streamed to a receiver
+        if(httplib_headers.find("Accept-Encoding") == httplib_headers.end())
+        {
+            if(!mCompression)
+                httplib_headers.emplace("Accept-Encoding", "identity");
+            else if(request.isStreamed())
+                httplib_headers.emplace("Accept-Encoding", sAcceptEncoding);
+        }
+
+        // Serve fresh responses from the cache, ask the upstream to confirm stale responses
+        std::string cache_key;
+        std::shared_ptr<const RestCacheEntry> cached;
+        if(mCache != nullptr && request.isSimple())
+        {
+            cache_key = getCacheKey(request);
+            cached = request.mCached != nullptr ? std::move(request.mCached) : mCache->find(cache_key);
+            if(cached != nullptr && cached->isFresh())
+            {
+                mCache->mHitCount++;
+                request.mFromCache = true;
+                request.mStatus = httplib::StatusCode::OK_200;
+                request.mResponse.setData(cached->mData);
+                request.mResponse.mContentType = cached->mContentType;
+                return true;
+            }
+
+            if(cached != nullptr)
+            {
+                if(!cached->mETag.empty())
+                    httplib_headers.emplace("If-None-Match", cached->mETag);
+                if(!cached->mLastModified.empty())
+                    httplib_headers.emplace("If-Modified-Since", cached->mLastModified);
+            }
+        }
+
+        httplib::Progress progress = [&request](uint64_t current, uint64_t total) -> bool
+        {
+            // Store the latest progress, the main thread samples it once per update
+            request.setProgress(current, total);
+            return !request.isAbandoned();
+        };
+
+        std::lock_guard<std::mutex> lock(connection.mMutex);
+        prepare(connection);
+
+        // Hand the request to the hedge thread, which sends a duplicate when no response arrived within the hedge delay
+        float hedge_delay = 0.0f;
+        bool hedged = connection.mHedgeClient != nullptr && request.isSimple() && mImpl->getHedgeDelay(mHedge, hedge_delay);
+        auto start = std::chrono::steady_clock::now();
+        if(hedged)
+        {
+            std::lock_guard<std::mutex> lock(connection.mHedgeMutex);
+            connection.mHedgeTarget = request.mTarget;
+            connection.mHedgeHeaders = httplib_headers;
+            connection.mHedgeDeadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float, std::milli>(hedge_delay));
+            connection.mHedgeCancelled = false;
+            connection.mWinner = 0;
+            connection.mHedgeState = Connection::EHedgeState::Armed;
+            connection.mHedgeCondition.notify_all();
+        }
+
+        mImpl->addInFlight(request);
+        request.setClients({ &connection.mClient, hedged ? connection.mHedgeClient.get() : nullptr });
+        httplib::Result result;
+        if(request.isAbandoned())
+        {
+            result = httplib::Result(nullptr, httplib::Error::Canceled);
+        }
+        else if(request.isStreamed())
+        {
+            // Hand the chunks to the receiver as they arrive, the body is not buffered
+            result = connection.mClient.Get(request.mTarget, httplib_headers, request.mResponseHandler, [&request](const char* data, size_t size)
+            {
+                request.mStreamedBytes += size;
+                return !request.isAbandoned() && request.mReceiver(data, size);
+            }, progress);
+        }
+        else if(request.mMethod == "DELETE")
+        {
+            result = connection.mClient.Delete(request.mTarget, httplib_headers, std::string(), std::string(), progress);
+        }
+        else if(request.mMethod != "GET" && request.mMethod != "HEAD")
+        {
+            uint64_t content_size = 0, wire_size = 0;
+            result = sendBody(connection.mClient, request.mMethod, request.mTarget, httplib_headers, request.mBody, mCompressionThreshold,
+                              [&request]() { return request.isAbandoned(); }, content_size, wire_size);
+            mUncompressedByteCount += content_size;
+            mCompressedByteCount += wire_size;
+        }
+        else if(request.mMethod == "HEAD")
+        {
+            // No body, the response handler inspects the response once it arrived
+            result = connection.mClient.Head(request.mTarget, httplib_headers);
+            if(result && request.mResponseHandler)
+                request.mResponseHandler(*result);
+        }
+        else
+        {
+            result = connection.mClient.Get(request.mTarget, httplib_headers, progress);
+        }
+        request.setClients({});
+        mImpl->removeInFlight(request);
+        connection.mLastUsed = std::chrono::steady_clock::now();
+
+        if(hedged)
+        {
+            std::unique_lock<std::mutex> hedge_lock(connection.mHedgeMutex);
+            if(connection.mHedgeState == Connection::EHedgeState::Armed)
+            {
+                // Completed before the hedge delay, nothing was sent
+                connection.mHedgeState = Connection::EHedgeState::Idle;
+                connection.mHedgeCondition.notify_all();
+            }
+            else if(connection.mHedgeState != Connection::EHedgeState::Idle)
+            {
+                // A duplicate was sent, the first response wins and the other request is cancelled
+                int undecided = 0;
+                if(result && connection.mWinner.compare_exchange_strong(undecided, 1))
+                {
+                    connection.mHedgeCancelled = true;
+                    connection.mHedgeClient->stop();
+                }
+
+                connection.mHedgeCondition.wait(hedge_lock, [&connection]() { return connection.mHedgeState == Connection::EHedgeState::Done; });
+                if(connection.mWinner == 2)
+                {
+                    mHedgeWinCount++;
+                    result = std::move(connection.mHedgeResult);
+                }
+                connection.mHedgeResult = httplib::Result();
+                connection.mHedgeState = Connection::EHedgeState::Idle;
+            }
+        }
+
+        // The receiver got all it needs and stopped the transfer, the rest of the body is never read
+        if(!result && request.mStopped && !request.isAbandoned())
+        {
+            mUncompressedByteCount += request.mStreamedBytes;
+            mCompressedByteCount += request.mStreamedBytes;
+            return true;
+        }
+
+        // Only plain requests are hedged, streamed and head requests would skew the observed latencies
+        if(result && connection.mHedgeClient != nullptr && request.isSimple())
+            mImpl->addLatency(mHedge, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        if(result)
+        {
+            // Bodies are decompressed by httplib while they are received on this worker thread
+            if(request.mMethod != "HEAD")
+            {
+                uint64_t content_size = request.isStreamed() ? request.mStreamedBytes : result->body.size();
+                mUncompressedByteCount += content_size;
+                mCompressedByteCount += getWireSize(*result, content_size);
+            }
+
+            request.mStatus = result->status;
+            if(result->has_header("Retry-After"))
+                request.mRetryAfter = std::atoi(result->get_header_value("Retry-After").c_str());
+
+            // The body of a streamed response was handed to the receiver, head responses have no body
+            if(request.isStreamed() || request.mMethod == "HEAD")
+            {
+                request.mResponse.mContentType = result->get_header_value("Content-Type");
+                return true;
+            }
+
+            // Not modified, reuse the cached body
+            if(cached != nullptr && result->status == httplib::StatusCode::NotModified_304)
+            {
+                mCache->mRevalidatedCount++;
+                auto refreshed = mCache->refresh(cache_key, *cached, *result);
+                request.mResponse.setData(refreshed->mData);
+                request.mResponse.mContentType = refreshed->mContentType;
+                return true;
+            }
+
+            // Requests that change the resource invalidate its cached response
+            if(mCache != nullptr && !request.isSimple())
+            {
+                if(result->status >= 200 && result->status < 400 && request.mMethod != "GET" && request.mMethod != "HEAD")
+                    mCache->remove(getCacheKey(request));
+                toRestResponse(*result, nullptr, cache_key, request.mResponse);
+                return true;
+            }
+
+            if(mCache != nullptr)
+                mCache->mMissCount++;
+            toRestResponse(*result, mCache.get(), cache_key, request.mResponse);
+            return true;
+        }
+
+        request.mError = result.error();
+        request.mErrorState.fail("Failed to get response from server : %s", to_string(result.error()).c_str());
+        return false;
+    }
+
+
+    void RestClient::runHedge(Connection& connection)
+    {
+        std::unique_lock<std::mutex> lock(connection.mHedgeMutex);
+        while(mRunning)
+        {
+            // Wait for a request, then for its hedge delay to pass unless the request completes first
+            connection.mHedgeCondition.wait(lock, [this, &connection]() { return !mRunning || connection.mHedgeState == Connection::EHedgeState::Armed; });
+            bool completed = connection.mHedgeCondition.wait_until(lock, connection.mHedgeDeadline, [this, &connection]()
+            {
+                return !mRunning || connection.mHedgeState != Connection::EHedgeState::Armed;
+            });
+            if(completed)
+                continue;
+
+            // Don't exceed the hedge rate
+            if(!mImpl->takeHedgeToken())
+            {
+                connection.mHedgeState = Connection::EHedgeState::Idle;
+                continue;
+            }
+
+            // Send the duplicate, cancelled when the original request completes first
+            connection.mHedgeState = Connection::EHedgeState::Sending;
+            std::string target = connection.mHedgeTarget;
+            httplib::Headers headers = connection.mHedgeHeaders;
+            lock.unlock();
+
+            mHedgeCount++;
+            auto result = connection.mHedgeClient->Get(target, headers, [&connection](uint64_t, uint64_t)
+            {
+                return !connection.mHedgeCancelled.load();
+            });
+
+            // Cancel the original request when the hedge wins, aborts the request that is in progress
+            int undecided = 0;
+            if(result && connection.mWinner.compare_exchange_strong(undecided, 2))
+                connection.mClient.stop();
+
+            lock.lock();
+            connection.mHedgeResult = std::move(result);
+            connection.mHedgeState = Connection::EHedgeState::Done;
+            connection.mHedgeCondition.notify_all();
+        }
+    }
+
+
+    float RestClient::getHedgeRate() const
+    {
+        std::lock_guard<std::mutex> lock(mImpl->mLatencyMutex);
+        return mImpl->mHedgeableCount > 0 ? static_cast<float>(mHedgeCount.load()) / static_cast<float>(mImpl->mHedgeableCount) : 0.0f;
+    }
+
+
+    bool RestClient::perform(Connection& connection, Request& request)
+    {
+        // The circuit breaker judges requests, not attempts: a request that is let through may use all of its attempts
+        if(!mImpl->acquire(mCircuitBreaker))
+        {
+            mRejectedCount++;
+            request.reset();
+            request.mErrorState.fail("Circuit open, %s is failing", mURL.c_str());
+            return false;
+        }
+
+        int max_attempts = std::max(1, mRetry.mMaxAttempts);
+        for(int attempt = 1; ; attempt++)
+        {
+            // Cancelled requests and cache hits say nothing about the health of the upstream
+            bool success = send(connection, request);
+            if(request.isAbandoned() || request.mFromCache)
+            {
+                mImpl->release(mCircuitBreaker);
+                return success && !request.isAbandoned();
+            }
+
+            // Responses with a retryable status are delivered as is when no attempts are left
+            // Requests that are not idempotent are never sent twice, streamed requests can't be retried once the receiver got data
+            if(!request.isRetryable(mRetry) || !request.isIdempotent() || request.mStreamedBytes > 0 || attempt >= max_attempts || !backOff(request, attempt))
+            {
+                mImpl->report(mCircuitBreaker, success && !request.hasRetryableStatus(mRetry));
+                return success;
+            }
+
+            mRetryCount++;
+            request.reset();
+        }
+    }
+
+
+    bool RestClient::backOff(Request& request, int attempt)
+    {
+        // Exponential delay, at least the delay the upstream asked for, capped at the maximum delay
+        float delay = static_cast<float>(mRetry.mInitialDelay) * std::pow(mRetry.mMultiplier, static_cast<float>(attempt - 1));
+        if(request.mRetryAfter >= 0)
+            delay = std::max(delay, request.mRetryAfter * 1000.0f);
+        delay = std::min(delay, static_cast<float>(mRetry.mMaxDelay));
+
+        // Drop a random part of the delay so clients that failed together don't retry together
+        static thread_local std::mt19937 generator(std::random_device{}());
+        std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+        delay *= 1.0f - std::clamp(mRetry.mJitter, 0.0f, 1.0f) * distribution(generator);
+
+        std::unique_lock<std::mutex> lock(mImpl->mStopMutex);
+        return !mImpl->mStopCondition.wait_for(lock, std::chrono::duration<float, std::milli>(std::max(delay, 0.0f)), [this]() { return !mRunning; });
+    }
+
+
+    ERestCircuitState RestClient::getCircuitState() const
+    {
+        std::lock_guard<std::mutex> lock(mImpl->mCircuitMutex);
+        return mImpl->mCircuitState;
+    }
+
+
+    void RestClient::sendPipelined(Connection& connection, std::vector<std::unique_ptr<Request>>& requests)
+    {
+        // Encode the targets the same way the regular client does
+        std::vector<RestPipeline::Exchange> exchanges(requests.size());
+        std::vector<RestPipeline::Exchange*> pending;
+        std::vector<bool> pipelined(requests.size(), true);
+        pending.reserve(requests.size());
+        bool closed = getCircuitState() == ERestCircuitState::Closed;
+        for(size_t i = 0; i < requests.size(); i++)
+        {
+            // Cached requests and requests that are not plain gets are sent through the regular client, as are all requests while the circuit is not closed
+            // Abandoned requests are dropped by the regular client without being sent
+            auto& request = *requests[i];
+            if(!closed || !request.isSimple() || request.isAbandoned())
+            {
+                pipelined[i] = false;
+                continue;
+            }
+
+            // The entry is handed to the regular client, which doesn't look it up again
+            if(mCache != nullptr)
+            {
+                request.mCached = mCache->find(getCacheKey(request));
+                if(request.mCached != nullptr)
+                {
+                    pipelined[i] = false;
+                    continue;
+                }
+            }
+            exchanges[i].mTarget = request.mTarget;
+            exchanges[i].mProgress = [&request](uint64_t current, uint64_t total)
+            {
+                // A pipelined response can't be skipped, abandoned requests are aborted with the pipeline
+                request.setProgress(current, total);
+                return true;
+            };
+            exchanges[i].mAbandoned = [&request]()
+            {
+                return request.isAbandoned();
+            };
+            pending.emplace_back(&exchanges[i]);
+        }
+
+        std::string error;
+        if(!pending.empty())
+        {
+            std::lock_guard<std::mutex> lock(connection.mMutex);
+            auto httplib_headers = toHTTPHeaders(mHeaders);
+            if(httplib_headers.find("Accept-Encoding") == httplib_headers.end())
+                httplib_headers.emplace("Accept-Encoding", mCompression ? sAcceptEncoding : "identity");
+
+            // Register the requests like the regular client does, so they report progress and can be cancelled
+            auto& pipeline = *connection.mPipeline;
+            preparePipeline(connection, pending.size());
+            for(size_t i = 0; i < requests.size(); i++)
+            {
+                if(!pipelined[i])
+                    continue;
+                mImpl->addInFlight(*requests[i]);
+                requests[i]->setPipeline(&pipeline);
+            }
+
+            // A pipeline that was aborted because all of its requests were cancelled didn't fail
+            bool sent = pipeline.send(pending, httplib_headers, error);
+            if(!sent && !std::all_of(pending.begin(), pending.end(), [](const auto* exchange) { return exchange->mReceived || exchange->mAbandoned(); }))
+                nap::Logger::warn(*this, "Pipelining failed on connection %i : %s", connection.mIndex, error.c_str());
+
+            for(size_t i = 0; i < requests.size(); i++)
+            {
+                if(!pipelined[i])
+                    continue;
+                requests[i]->setPipeline(nullptr);
+                mImpl->removeInFlight(*requests[i]);
+            }
+            connection.mLastUsed = std::chrono::steady_clock::now();
+        }
+
+        if(connection.mPipeline != nullptr && !connection.mPipeline->isSupported())
+        {
+            nap::Logger::warn(*this, "Upstream does not support pipelining, sending requests one at a time on connection %i", connection.mIndex);
+            connection.mPipeline.reset();
+        }
+
+        for(size_t i = 0; i < requests.size(); i++)
+        {
+            auto& request = *requests[i];
+            auto& exchange = exchanges[i];
+
+            // Requests the upstream didn't answer, or answered with a status that is retried, are sent again through the regular client
+            request.mStatus = exchange.mResponse.status;
+            if(!pipelined[i] || !exchange.mReceived || (mRetry.mMaxAttempts > 1 && request.hasRetryableStatus(mRetry)))
+            {
+                // Abandoned requests are not sent again
+                request.reset();
+                if(request.isAbandoned())
+                {
+                    if(!pipelined[i])
+                        mCancelledCount++;
+                    request.mSuccess = false;
+                    request.mErrorState.fail("Request cancelled");
+                    continue;
+                }
+                request.mSuccess = perform(connection, request);
+                continue;
+            }
+            mImpl->report(mCircuitBreaker, !request.hasRetryableStatus(mRetry));
+
+            auto size = exchange.mResponse.body.size();
+            mUncompressedByteCount += size;
+            mCompressedByteCount += getWireSize(exchange.mResponse, size);
+
+            if(mCache != nullptr)
+                mCache->mMissCount++;
+            toRestResponse(exchange.mResponse, mCache.get(), mCache != nullptr ? getCacheKey(request) : std::string(), request.mResponse);
+            request.mSuccess = true;
+        }
+    }
+
+
+    std::string RestClient::getCacheKey(const Request& request) const
+    {
+        return mURL + request.mTarget + mImpl->mCacheKeyHeaders;
+    }
+
+
+    RestRequestHandle RestClient::get(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, std::function<void(const RestResponse &)> onSuccess, std::function<void(const utility::ErrorState &)> onError, const RestRequestOptions& options)
+    {
+        // Create the request, params are encoded right away so the caller keeps ownership of the values
+        auto request = std::make_unique<Request>();
+        request->mTarget = toHTTPTarget(address, toHTTPParams(params, mArraySeparator));
+        request->mOnSuccess = std::move(onSuccess);
+        request->mOnError = std::move(onError);
+        return submit(std::move(request), options);
+    }
+
+
+    RestRequestHandle RestClient::getStream(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, RestContentReceiver onData, std::function<void(const RestResponse &)> onSuccess, std::function<void(const utility::ErrorState &)> onError, const RestRequestOptions& options)
+    {
+        auto request = std::make_unique<Request>();
+        request->mTarget = toHTTPTarget(address, toHTTPParams(params, mArraySeparator));
+        request->mReceiver = std::move(onData);
+        request->mOnSuccess = std::move(onSuccess);
+        request->mOnError = std::move(onError);
+        return submit(std::move(request), options);
+    }
+
+
+    RestRequestHandle RestClient::getJson(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, std::function<void(const rapidjson::Value &)> onSuccess, std::function<void(const utility::ErrorState &)> onError, const RestRequestOptions& options)
+    {
+        // The document is shared by the parse step on the worker and the success callback, it returns its memory to the pool with the request
+        auto document = std::make_shared<RestJsonDocument>(mImpl->mJsonPool);
+        auto request = std::make_unique<Request>();
+        request->mTarget = toHTTPTarget(address, toHTTPParams(params, mArraySeparator));
+        request->mOnReceived = [document](Request& request)
+        {
+            request.mSuccess = document->parse(request.mResponse, request.mErrorState);
+        };
+        request->mOnSuccess = [document, on_success = std::move(onSuccess)](const RestResponse&)
+        {
+            on_success(document->getDocument());
+        };
+        request->mOnError = std::move(onError);
+        return submit(std::move(request), options);
+    }
+
+
+    RestRequestHandle RestClient::submitObject(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, const rtti::Instance& object, std::function<void()> onSuccess, std::function<void(const utility::ErrorState &)> onError, const RestRequestOptions& options)
+    {
+        // The document is only needed while the object is read, its memory goes back to the pool right away
+        auto request = std::make_unique<Request>();
+        request->mTarget = toHTTPTarget(address, toHTTPParams(params, mArraySeparator));
+        request->mOnReceived = [pool = mImpl->mJsonPool, object](Request& request)
+        {
+            RestJsonDocument document(pool);
+            request.mSuccess = document.parse(request.mResponse, request.mErrorState) &&
+                RestJsonReader::read(document.getDocument(), object, request.mErrorState);
+        };
+        request->mOnSuccess = [on_success = std::move(onSuccess)](const RestResponse&)
+        {
+            on_success();
+        };
+        request->mOnError = std::move(onError);
+        return submit(std::move(request), options);
+    }
+
+
+    RestRequestHandle RestClient::getJsonValues(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, const std::vector<std::string> &pointers, std::function<void(const RestValueMap &)> onSuccess, std::function<void(const utility::ErrorState &)> onError, const RestRequestOptions& options)
+    {
+        auto extractor = std::make_shared<RestJsonExtractor>();
+        auto request = std::make_unique<Request>();
+        request->mTarget = toHTTPTarget(address, toHTTPParams(params, mArraySeparator));
+        if(extractor->init(pointers, request->mErrorState))
+        {
+            // The body is parsed as it arrives, the transfer stops once all paths are resolved or the body turned out invalid
+            request->mReceiver = [extractor, &stopped = request->mStopped](const char* data, size_t size)
+            {
+                stopped = !extractor->write(data, size);
+                return !stopped;
+            };
+        }
+        request->mOnReceived = [extractor](Request& request)
+        {
+            request.mSuccess = extractor->finish(request.mErrorState);
+        };
+        request->mOnSuccess = [extractor, on_success = std::move(onSuccess)](const RestResponse&)
+        {
+            on_success(extractor->getValues());
+        };
+        request->mOnError = std::move(onError);
+        return submit(std::move(request), options);
+    }
+
+
+    RestRequestHandle RestClient::post(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, RestRequestBody body, std::function<void(const RestResponse &)> onSuccess, std::function<void(const utility::ErrorState &)> onError, const RestRequestOptions& options)
+    {
+        return submitBody("POST", address, params, std::move(body), std::move(onSuccess), std::move(onError), options);
+    }
+
+
+    RestRequestHandle RestClient::put(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, RestRequestBody body, std::function<void(const RestResponse &)> onSuccess, std::function<void(const utility::ErrorState &)> onError, const RestRequestOptions& options)
+    {
+        return submitBody("PUT", address, params, std::move(body), std::move(onSuccess), std::move(onError), options);
+    }
+
+
+    RestRequestHandle RestClient::patch(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, RestRequestBody body, std::function<void(const RestResponse &)> onSuccess, std::function<void(const utility::ErrorState &)> onError, const RestRequestOptions& options)
+    {
+        return submitBody("PATCH", address, params, std::move(body), std::move(onSuccess), std::move(onError), options);
+    }
+
+
+    RestRequestHandle RestClient::del(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, std::function<void(const RestResponse &)> onSuccess, std::function<void(const utility::ErrorState &)> onError, const RestRequestOptions& options)
+    {
+        return submitBody("DELETE", address, params, RestRequestBody(), std::move(onSuccess), std::move(onError), options);
+    }
+
+
+    RestRequestHandle RestClient::submitBody(const char* method, const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, RestRequestBody body, std::function<void(const RestResponse &)> onSuccess, std::function<void(const utility::ErrorState &)> onError, const RestRequestOptions& options)
+    {
+        auto request = std::make_unique<Request>();
+        request->mMethod = method;
+        request->mTarget = toHTTPTarget(address, toHTTPParams(params, mArraySeparator));
+        request->mBody = std::move(body);
+        request->mOnSuccess = std::move(onSuccess);
+        request->mOnError = std::move(onError);
+        return submit(std::move(request), options);
+    }
+
+
+    RestRequestHandle RestClient::submit(std::unique_ptr<Request> request, const RestRequestOptions& options)
+    {
+        request->mExecutor = options.mExecutor;
+        request->mCustomExecutor = options.mCustomExecutor;
+        request->mPriority = options.mPriority;
+        request->mState = std::make_shared<RestRequestHandle::State>();
+        RestRequestHandle handle(request->mState);
+        if(request->mExecutor == ERestCallbackExecutor::Custom && request->mCustomExecutor == nullptr)
+        {
+            nap::Logger::warn(*this, "No custom executor provided, executing callbacks on the main thread");
+            request->mExecutor = ERestCallbackExecutor::MainThread;
+        }
+
+        // Requests with invalid arguments are never sent
+        if(request->mErrorState.hasErrors())
+        {
+            execute(std::move(request));
+            return handle;
+        }
+
+        // Fail right away while the upstream is down, instead of queueing requests that will fail
+        if(mImpl->isRejecting(mCircuitBreaker))
+        {
+            mRejectedCount++;
+            request->mErrorState.fail("Circuit open, %s is failing", mURL.c_str());
+            execute(std::move(request));
+            return handle;
+        }
 
-    static std::vector<std::unique_ptr<APIBaseValue>> copyParams(const std::vector<std::unique_ptr<APIBaseValue>> &params);
+        // Attach to an identical request that is queued or in flight, ordered requests are always sent to keep their order
+        // Requests don't attach to cancelled requests or requests with a lower priority, they take their place instead
+        // Streamed requests deliver the body to their own receiver and are always sent
+        if(mDeduplicate && !options.mOrdered && request->isSimple())
+        {
+            std::lock_guard<std::mutex> lock(mImpl->mPendingMutex);
+            auto it = mImpl->mPending.find(request->mTarget);
+            if(it != mImpl->mPending.end() && it->second->mPriority >= request->mPriority)
+            {
+                // Count the dependent before checking for cancellation, a concurrent cancel either sees it or is seen here
+                auto& leader = *it->second;
+                leader.mState->mDependents++;
+                if(!leader.isCancelled())
+                {
+                    request->mState->mLeader = leader.mState;
+                    leader.mFollowers.emplace_back(std::move(request));
+                    mDeduplicatedCount++;
+                    return handle;
+                }
+                leader.mState->removeDependent();
+            }
+            request->mShared = true;
+            mImpl->mPending[request->mTarget] = request.get();
+        }
 
-    static httplib::Params toHTTPParams(const std::vector<std::unique_ptr<APIBaseValue>> &params, const std::string& arraySeparator);
+        enqueue(std::move(request), options.mOrdered);
+        return handle;
+    }
 
-    static httplib::Headers toHTTPHeaders(const std::vector<RestHeader>& headers);
 
-    template<typename T>
-    static void addValue(std::vector<std::unique_ptr<APIBaseValue>>& copy, APIBaseValue& value);
+    RestRequestHandle RestClient::download(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, const std::string &path, std::function<void(const RestDownloadResult &)> onSuccess, std::function<void(const utility::ErrorState &)> onError, const RestDownloadOptions& options)
+    {
+        auto download = std::make_shared<Download>(path);
+        download->mTarget = toHTTPTarget(address, toHTTPParams(params, mArraySeparator));
+        download->mOptions = options;
+        download->mOnSuccess = std::move(onSuccess);
+        download->mOnError = std::move(onError);
+        download->mState = std::make_shared<RestRequestHandle::State>();
+        if(options.mExecutor == ERestCallbackExecutor::Custom && options.mCustomExecutor == nullptr)
+        {
+            nap::Logger::warn(*this, "No custom executor provided, executing callbacks on the main thread");
+            download->mOptions.mExecutor = ERestCallbackExecutor::MainThread;
+        }
 
-    ////////////////////////////////////////////////////////////////////////////
-    //// RestClient::Impl
-    ////////////////////////////////////////////////////////////////////////////
+        // Ask the upstream for the size of the file and if it accepts Range requests before splitting it into segments
+        // The size of the file is asked for, not the size of a compressed representation of it
+        auto probe = std::make_unique<Request>();
+        probe->mTarget = download->mTarget;
+        probe->mMethod = "HEAD";
+        probe->mHeaders.emplace("Accept-Encoding", "identity");
+        probe->mPriority = options.mPriority;
+        probe->mState = download->mState;
+        probe->mResponseHandler = [download](const httplib::Response& response)
+        {
+            // Weak ETags can't be used for If-Range
+            auto etag = response.get_header_value("ETag");
+            download->mSize = response.get_header_value_u64("Content-Length");
+            download->mRanges = response.get_header_value("Accept-Ranges") == "bytes";
+            download->mValidator = !etag.empty() && etag.compare(0, 2, "W/") != 0 ? etag : response.get_header_value("Last-Modified");
+            download->mContentType = response.get_header_value("Content-Type");
+            return true;
+        };
+        probe->mOnSent = [this, download](Request& request)
+        {
+            startDownload(download, request);
+        };
 
-    struct RestClient::Impl
+        enqueue(std::move(probe), false);
+        return RestRequestHandle(download->mState);
+    }
+
+
+    void RestClient::startDownload(const std::shared_ptr<Download>& download, const Request& probe)
     {
-        Impl(const std::string &url) : mClient(httplib::Client(url))
-        {}
+        if(probe.isCancelled())
+            return;
 
-        httplib::Client mClient;
-    };
+        // Upstreams that don't implement HEAD are asked for the file right away
+        bool described = probe.mSuccess && probe.mStatus >= 200 && probe.mStatus < 300;
+        if(!described && (!probe.mSuccess || (probe.mStatus != 405 && probe.mStatus != 501)))
+        {
+            download->fail(probe.mSuccess ? utility::stringFormat("Unable to download %s, status %i", download->mTarget.c_str(), probe.mStatus) : probe.mErrorState.toString());
+            completeDownload(*download);
+            return;
+        }
 
-    ////////////////////////////////////////////////////////////////////////////
-    //// RestClient
-    ////////////////////////////////////////////////////////////////////////////
+        // Files are only split and resumed when the upstream knows their size and accepts Range requests
+        auto& file = download->mFile;
+        bool ranges = described && download->mRanges && download->mSize > 0;
+        auto key = mURL + download->mTarget;
+        if(!ranges || !download->mOptions.mResume || !file.resume(key, download->mValidator, download->mSize))
+        {
+            auto min_size = static_cast<uint64_t>(std::max(download->mOptions.mMinSegmentSize, 1));
+            auto count = ranges ? static_cast<int>(std::clamp<uint64_t>(download->mSize / min_size, 1, std::max(download->mOptions.mSegments, 1))) : 1;
+            utility::ErrorState error_state;
+            if(!file.create(key, ranges ? download->mValidator : std::string(), ranges ? download->mSize : 0, count, error_state))
+            {
+                download->fail(error_state.toString());
+                completeDownload(*download);
+                return;
+            }
+        }
 
-    RestClient::RestClient(RestService &service) : mService(service)
-    {}
+        // Fetch the segments that are not complete yet, every segment writes at its own position in the file
+        std::vector<std::unique_ptr<Request>> segments;
+        for(auto& segment : file.getSegments())
+        {
+            if(segment->isComplete())
+                continue;
 
+            auto request = std::make_unique<Request>();
+            request->mTarget = download->mTarget;
+            request->mPriority = download->mOptions.mPriority;
+            request->mState = download->mState;
 
-    RestClient::~RestClient()
-    {}
+            uint64_t offset = segment->mStart + segment->mReceived.load();
+            if(ranges)
+            {
+                // Ranges are offsets in the file, not in a compressed representation of it
+                request->mHeaders.emplace("Accept-Encoding", "identity");
+                request->mHeaders.emplace("Range", "bytes=" + std::to_string(offset) + "-" + std::to_string(segment->mEnd - 1));
+                if(!download->mValidator.empty())
+                    request->mHeaders.emplace("If-Range", download->mValidator);
+            }
 
+            // Only the requested range may be written at the position of the segment, anything else fails the download
+            request->mResponseHandler = [download, ranges, offset](const httplib::Response& response)
+            {
+                if(download->mFailed)
+                    return false;
 
-    bool RestClient::init(nap::utility::ErrorState &errorState)
+                if(ranges && response.status == httplib::StatusCode::OK_200)
+                {
+                    download->mChanged = true;
+                    download->fail(utility::stringFormat("Unable to resume %s, the file changed on the server", download->mTarget.c_str()));
+                    return false;
+                }
+
+                bool accepted = ranges ?
+                    response.status == httplib::StatusCode::PartialContent_206 && response.get_header_value("Content-Range").compare(0, 6 + std::to_string(offset).size() + 1, "bytes " + std::to_string(offset) + "-") == 0 :
+                    response.status >= 200 && response.status < 300;
+                if(!accepted)
+                {
+                    download->fail(utility::stringFormat("Unable to download %s, status %i", download->mTarget.c_str(), response.status));
+                    return false;
+                }
+
+                // Without ranges the written size is checked against the Content-Length, which is the encoded size of a compressed body
+                std::string encoding = response.get_header_value("Content-Encoding");
+                if(!ranges && response.has_header("Content-Length") && (encoding.empty() || encoding == "identity"))
+                    download->mFile.setContentLength(response.get_header_value_u64("Content-Length"));
+                return true;
+            };
+
+            request->mReceiver = [download, segment = segment.get()](const char* data, size_t size)
+            {
+                if(download->mFailed)
+                    return false;
+
+                if(!download->mFile.write(*segment, data, size))
+                {
+                    download->fail(utility::stringFormat("Unable to write %s", download->mFile.getPath().c_str()));
+                    return false;
+                }
+
+                // Store the progress every now and then, a crash loses at most the bytes written since
+                if(download->mUnsavedBytes.fetch_add(size) + size >= sDownloadSaveInterval)
+                {
+                    download->mUnsavedBytes = 0;
+                    download->mFile.save();
+                }
+                return true;
+            };
+
+            request->mOnSent = [this, download](Request& request)
+            {
+                finishSegment(*download, request);
+            };
+            segments.emplace_back(std::move(request));
+        }
+
+        // A resumed file might be complete already
+        if(segments.empty())
+        {
+            completeDownload(*download);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(download->mMutex);
+            download->mRemaining = static_cast<int>(segments.size());
+        }
+        for(auto& segment : segments)
+            enqueue(std::move(segment), false);
+    }
+
+
+    void RestClient::finishSegment(Download& download, const Request& segment)
     {
-        mImpl = std::make_unique<Impl>(mURL);
-        mImpl->mClient.set_ca_cert_path("", mCertPath);
-        if(mTimeOutSeconds > 0)
+        if(!segment.mSuccess)
+            download.fail(segment.mErrorState.toString());
+
         {
-            mImpl->mClient.set_connection_timeout(mTimeOutSeconds, 0);
-            mImpl->mClient.set_read_timeout(mTimeOutSeconds, 0);
-            mImpl->mClient.set_write_timeout(mTimeOutSeconds, 0);
+            std::lock_guard<std::mutex> lock(download.mMutex);
+            if(--download.mRemaining > 0)
+                return;
         }
+        completeDownload(download);
+    }
 
 
-        return true;
+    void RestClient::completeDownload(Download& download)
+    {
+        // The callbacks of the caller are handed to its executor, like the callbacks of any other request
+        auto completion = std::make_unique<Request>();
+        completion->mExecutor = download.mOptions.mExecutor;
+        completion->mCustomExecutor = download.mOptions.mCustomExecutor;
+        completion->mState = download.mState;
+        completion->mOnError = download.mOnError;
+
+        auto& file = download.mFile;
+        if(!download.mFailed && !file.isComplete())
+            download.fail(utility::stringFormat("Download of %s is incomplete", download.mTarget.c_str()));
+
+        if(download.mFailed)
+        {
+            // Keep the partial file, unless it belongs to an older version of the file
+            if(download.mChanged)
+            {
+                file.discard();
+            }
+            else
+            {
+                file.save();
+                file.close();
+            }
+            std::lock_guard<std::mutex> lock(download.mMutex);
+            completion->mErrorState = download.mErrorState;
+        }
+        else if(file.commit(completion->mErrorState))
+        {
+            RestDownloadResult result;
+            result.mPath = file.getPath();
+            result.mContentType = download.mContentType;
+            result.mSize = file.getSize() > 0 ? file.getSize() : file.getSegments().front()->mReceived.load();
+            result.mResumedBytes = file.getResumedBytes();
+            result.mSegments = static_cast<int>(file.getSegments().size());
+            completion->mOnSuccess = [on_success = download.mOnSuccess, result](const RestResponse&)
+            {
+                on_success(result);
+            };
+            completion->mSuccess = true;
+        }
+        execute(std::move(completion));
     }
 
 
-    bool RestClient::start(nap::utility::ErrorState &errorState)
+    RestRequestHandle RestClient::getBatch(const std::vector<RestBatchRequest> &requests, std::function<void(const std::vector<RestBatchResult> &)> onComplete, const RestBatchOptions& options)
     {
-        mService.registerRestClient(*this);
+        auto batch = std::make_shared<Batch>();
+        batch->mOptions = options;
+        batch->mOnComplete = std::move(onComplete);
+        batch->mState = std::make_shared<RestRequestHandle::State>();
+        batch->mStart = std::chrono::steady_clock::now();
+        if(options.mExecutor == ERestCallbackExecutor::Custom && options.mCustomExecutor == nullptr)
+        {
+            nap::Logger::warn(*this, "No custom executor provided, executing callbacks on the main thread");
+            batch->mOptions.mExecutor = ERestCallbackExecutor::MainThread;
+        }
 
-        mRunning = true;
-        mThread = std::thread(&RestClient::run, this);
-        return true;
+        // Params are encoded right away so the caller keeps ownership of the values
+        batch->mTargets.reserve(requests.size());
+        for(const auto& request : requests)
+            batch->mTargets.emplace_back(toHTTPTarget(request.mAddress, toHTTPParams(request.mParams, mArraySeparator)));
+        batch->mResults.resize(requests.size());
+        batch->mRemaining = requests.size();
+
+        RestRequestHandle handle(batch->mState);
+        if(requests.empty())
+        {
+            completeBatch(*batch);
+            return handle;
+        }
+
+        // Queue up to the concurrency limit, every completed request queues the next one
+        size_t count = options.mMaxConcurrency > 0 ? std::min(requests.size(), static_cast<size_t>(options.mMaxConcurrency)) : requests.size();
+        {
+            std::lock_guard<std::mutex> lock(batch->mMutex);
+            batch->mNext = count;
+        }
+        for(size_t index = 0; index < count; index++)
+            startBatchItem(batch, index);
+        return handle;
     }
 
 
-    void RestClient::stop()
+    void RestClient::startBatchItem(const std::shared_ptr<Batch>& batch, size_t index)
     {
-        mService.removeRestClient(*this);
-
-        mRequestEvent.cancelWait();
-        mRunning = false;
-        mThread.join();
-        mImpl->mClient.stop();
+        // Only written here, read once the request completes
+        batch->mResults[index].mStart = batch->getElapsed();
+
+        auto request = std::make_unique<Request>();
+        request->mTarget = batch->mTargets[index];
+        request->mPriority = batch->mOptions.mPriority;
+        request->mState = batch->mState;
+        request->mOnSent = [this, batch, index](Request& request)
+        {
+            finishBatchItem(batch, index, request);
+        };
+        enqueue(std::move(request), false);
     }
 
 
-    bool RestClient::getBlocking(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, nap::RestResponse &response, utility::ErrorState &errorState)
+    void RestClient::finishBatchItem(const std::shared_ptr<Batch>& batch, size_t index, Request& request)
     {
-        auto httplib_params = toHTTPParams(params, mArraySeparator);
-        auto httplib_headers = toHTTPHeaders(mHeaders);
-        httplib::Progress progress = [&](uint64_t current, uint64_t total) -> bool
+        size_t next = batch->mTargets.size();
+        bool complete = false;
         {
-            // Dispatch progress on main thread
-            this->mCallbackQueue.enqueue([this, current, total]()
+            std::lock_guard<std::mutex> lock(batch->mMutex);
+            auto& result = batch->mResults[index];
+            result.mSuccess = request.mSuccess;
+            result.mResponse = std::move(request.mResponse);
+            result.mErrorState = request.mErrorState;
+            result.mDuration = batch->getElapsed() - result.mStart;
+
+            // A cancelled batch drops the requests that are not queued yet
+            if(request.isCancelled())
             {
-                mProgressSignal.trigger(current, total);
-            });
-            return true;
+                for(size_t skipped = batch->mNext; skipped < batch->mTargets.size(); skipped++)
+                    batch->mResults[skipped].mErrorState.fail("Request cancelled");
+                batch->mRemaining -= batch->mTargets.size() - batch->mNext;
+                batch->mNext = batch->mTargets.size();
+            }
+            else if(batch->mNext < batch->mTargets.size())
+            {
+                next = batch->mNext++;
+            }
+            complete = --batch->mRemaining == 0;
+        }
+
+        if(next < batch->mTargets.size())
+            startBatchItem(batch, next);
+        if(complete)
+            completeBatch(*batch);
+    }
+
+
+    void RestClient::completeBatch(Batch& batch)
+    {
+        // The results are handed to the executor of the caller, like the callbacks of any other request
+        auto completion = std::make_unique<Request>();
+        completion->mExecutor = batch.mOptions.mExecutor;
+        completion->mCustomExecutor = batch.mOptions.mCustomExecutor;
+        completion->mState = batch.mState;
+        auto results = std::make_shared<std::vector<RestBatchResult>>(std::move(batch.mResults));
+        completion->mOnSuccess = [on_complete = batch.mOnComplete, results](const RestResponse&)
+        {
+            on_complete(*results);
         };
-        auto result = mImpl->mClient.Get(address, httplib_params, httplib_headers, progress);
+        completion->mSuccess = true;
+        execute(std::move(completion));
+    }
 
-        if(result)
+
+    void RestClient::enqueue(std::unique_ptr<Request> request, bool ordered)
+    {
+        // Add the request to the queue of its priority, request will be processed in a worker thread
+        auto& queue = ordered ? mOrderedRequestQueue : mRequestQueues[static_cast<int>(request->mPriority)];
+        queue.enqueue(std::move(request));
+
+        // Signal that a request has been added to the queue
+        notifyWorkers(ordered);
+    }
+
+
+    void RestClient::prepare(Connection& connection)
+    {
+        // Close connections that have been idle for too long, the server might have dropped them already
+        bool open = connection.mClient.is_socket_open() != 0;
+        if(open && mIdleTimeOutSeconds > 0 && std::chrono::steady_clock::now() - connection.mLastUsed > std::chrono::seconds(mIdleTimeOutSeconds))
         {
-            response.mData = result->body;
-            response.mContentType = result->get_header_value("Content-Type");
-            return true;
+            connection.mClient.stop();
+            open = false;
         }
 
-        errorState.fail("Failed to get response from server : %s", to_string(result.error()).c_str());
-        return false;
+        if(open)
+            mReusedConnectionCount++;
+        else
+            mNewConnectionCount++;
     }
 
 
-    void RestClient::get(const std::string &address, const std::vector<std::unique_ptr<APIBaseValue>> &params, std::function<void(const RestResponse &)> onSuccess, std::function<void(const utility::ErrorState &)> onError)
+    void RestClient::preparePipeline(Connection& connection, size_t count)
     {
-        // create deep copy of params
-        auto params_copy = copyParams(params);
+        // Close pipelines that have been idle for too long, like regular connections
+        auto& pipeline = *connection.mPipeline;
+        bool open = pipeline.isOpen();
+        if(open && mIdleTimeOutSeconds > 0 && std::chrono::steady_clock::now() - connection.mLastUsed > std::chrono::seconds(mIdleTimeOutSeconds))
+        {
+            pipeline.close();
+            open = false;
+        }
+
+        // Only the first request opens a new connection, the others are written to it right after
+        mReusedConnectionCount += open ? count : count - 1;
+        if(!open)
+            mNewConnectionCount++;
+    }
+
 
-        // generate uuid
-        std::string uuid4 = math::generateUUID();
+    void RestClient::warmUp(Connection& connection)
+    {
+        std::lock_guard<std::mutex> lock(connection.mMutex);
+        auto result = connection.mClient.Head(mWarmUpAddress);
+        connection.mLastUsed = std::chrono::steady_clock::now();
+        if(!result)
+            nap::Logger::warn(*this, "Failed to warm up connection %i : %s", connection.mIndex, to_string(result.error()).c_str());
+    }
 
-        // move params
-        mRequestParamsCache.emplace(uuid4, std::move(params_copy));
 
-        // Add the request to the queue, request will be processed in the worker thread
-        mRequestQueue.enqueue([this, uuid4, address, onSuccess, onError] ()
+    void RestClient::dispatch(std::unique_ptr<Request> request)
+    {
+        // Stop accepting identical requests, they complete with the result of this request
+        std::vector<std::unique_ptr<Request>> followers;
+        if(request->mShared)
         {
-            // Currently in worker thread
+            std::lock_guard<std::mutex> lock(mImpl->mPendingMutex);
+            mImpl->erasePending(*request);
+            followers = std::move(request->mFollowers);
+        }
 
-            // Create response object and error state
-            RestResponse response;
-            utility::ErrorState errorState;
+        // Cancelled followers are dropped
+        followers.erase(std::remove_if(followers.begin(), followers.end(), [](const auto& follower) { return follower->isCancelled(); }), followers.end());
+        for(auto& follower : followers)
+        {
+            follower->mSuccess = request->mSuccess;
+            follower->mResponse = request->mResponse;
+            follower->mErrorState = request->mErrorState;
+        }
 
-            // Send the request
-            if(getBlocking(address, mRequestParamsCache[uuid4], response, errorState))
-            {
-                // Callback on success, execute on main thread
-                mCallbackQueue.enqueue([this, uuid4, onSuccess, response]()
-                {
-                    // Currently in main thread
+        execute(std::move(request));
+        for(auto& follower : followers)
+            execute(std::move(follower));
+    }
 
-                    // callback on success
-                    onSuccess(response);
 
-                    // remove params from cache
-                    mRequestParamsCache.erase(uuid4);
-                });
+    void RestClient::execute(std::unique_ptr<Request> request)
+    {
+        // The requests of a download are completed by the download
+        if(request->mOnSent)
+        {
+            request->mOnSent(*request);
+            return;
+        }
+
+        // The response is processed here, on the worker, the callbacks receive the result
+        if(request->mSuccess && request->mOnReceived != nullptr && !request->isCancelled())
+            request->mOnReceived(*request);
+
+        switch(request->mExecutor)
+        {
+        case ERestCallbackExecutor::MainThread:
+            {
+                // Completed on the main thread by the service
+                mCompletionQueue.enqueue(std::move(request));
+                break;
             }
-            else
+        case ERestCallbackExecutor::Worker:
+            {
+                // Complete right away on this worker thread
+                flushProgress(*request);
+                request->complete();
+                break;
+            }
+        case ERestCallbackExecutor::Custom:
             {
-                // Callback on error, execute on main thread
-                mCallbackQueue.enqueue([this, uuid4, onError, errorState]()
+                // The executor may run the task on any thread at any time, it takes ownership of the request
+                flushProgress(*request);
+                std::shared_ptr<Request> shared = std::move(request);
+                shared->mCustomExecutor([shared]()
                 {
-                    // Currently in main thread
-
-                    // callback on error
-                    onError(errorState);
-
-                    // remove params from cache
-                    mRequestParamsCache.erase(uuid4);
+                    shared->complete();
                 });
+                break;
             }
-        });
-
-        // Signal that a request has been added to the queue
-        mRequestEvent.set();
+        }
     }
 
 
-    void RestClient::update(double deltaTime)
+    void RestClient::flushProgress(Request& request)
     {
-        if(mCallbackQueue.size_approx() > 0)
+        uint64_t current, total;
+        if(request.takeProgress(current, total))
         {
-            // Process the callback queue
-            std::function<void()> callback;
-            while(mCallbackQueue.try_dequeue(callback))
+            mCallbackQueue.enqueue(Task::create([this, current, total]()
             {
-                callback();
-            }
+                mProgressSignal.trigger(current, total);
+            }));
         }
     }
 
 
-    void RestClient::run()
+    void RestClient::notifyWorkers(bool ordered)
     {
-        while(mRunning)
+        // Ordered requests are only handled by the first connection, other requests by any idle connection
+        if(ordered)
         {
-            // Wait for a request to be added to the queue
-            mRequestEvent.wait();
+            mImpl->mConnections.front()->mEvent.set();
+            return;
+        }
+
+        for(auto& connection : mImpl->mConnections)
+            connection->mEvent.set();
+    }
+
 
-            // Process the request queue
-            std::function<void()> request;
-            while(mRequestQueue.try_dequeue(request))
+    void RestClient::update(double deltaTime)
+    {
+        // Report the latest progress of requests that are being sent, at most once per request
+        // The signal is triggered outside of the lock, slots are allowed to make new requests
+        uint64_t current, total;
+        std::vector<std::pair<uint64_t, uint64_t>> progress;
+        {
+            std::lock_guard<std::mutex> lock(mImpl->mInFlightMutex);
+            for(auto* in_flight : mImpl->mInFlight)
             {
-                request();
+                if(in_flight->takeProgress(current, total))
+                    progress.emplace_back(current, total);
             }
         }
+        for(const auto& [received, expected] : progress)
+            mProgressSignal.trigger(received, expected);
     }
 
-    ////////////////////////////////////////////////////////////////////////////
-    //// Helper functions
-    ////////////////////////////////////////////////////////////////////////////
 
-    static std::unordered_map<rtti::TypeInfo, std::function<void(std::vector<std::unique_ptr<APIBaseValue>>&, APIBaseValue&)>> copyValueMap =
-    {
-        {RTTI_OF(int),          addValue<int>},
-        {RTTI_OF(float),        addValue<float>},
-        {RTTI_OF(bool),         addValue<bool>},
-        {RTTI_OF(std::string),  addValue<std::string>},
-        {RTTI_OF(double),       addValue<double>},
-        {RTTI_OF(long),         addValue<long>},
-        {RTTI_OF(std::vector<int>),         addValue<std::vector<int> >},
-        {RTTI_OF(std::vector<float>),       addValue<std::vector<float> >},
-        {RTTI_OF(std::vector<bool>),        addValue<std::vector<bool> >},
-        {RTTI_OF(std::vector<std::string>), addValue<std::vector<std::string> >},
-        {RTTI_OF(std::vector<double>),      addValue<std::vector<double> >},
-        {RTTI_OF(std::vector<long>),        addValue<std::vector<long> >},
-    };
+    bool RestClient::complete()
+    {
+        // Main thread tasks are counted against the frame budget of the service, like completed requests
+        std::unique_ptr<Task> task;
+        if(mCallbackQueue.try_dequeue(task))
+        {
+            task->run();
+            return true;
+        }
+
+        std::unique_ptr<Request> request;
+        if(!mCompletionQueue.try_dequeue(request))
+            return false;
+
+        if(request->isCancelled())
+            return true;
+
+        // Report progress that was not sampled yet
+        uint64_t current, total;
+        if(request->takeProgress(current, total))
+            mProgressSignal.trigger(current, total);
+
+        request->complete();
+        return true;
+    }
+
+
+    size_t RestClient::getPendingCount() const
+    {
+        return mCallbackQueue.size_approx() + mCompletionQueue.size_approx();
+    }
 
 
-    static std::vector<std::unique_ptr<APIBaseValue>> copyParams(const std::vector<std::unique_ptr<APIBaseValue>> &params)
+    void RestClient::run(Connection& connection)
     {
-        std::vector<std::unique_ptr<APIBaseValue>> copy;
-        for(auto &param : params)
+        // Open the connection before the first request is made
+        if(mWarmUp && mKeepAlive)
+            warmUp(connection);
+
+        while(mRunning)
         {
-            if(copyValueMap.find(param->getRepresentedType()) == copyValueMap.end())
+            // Wait for a request to be added to the queue
+            connection.mEvent.wait();
+
+            // Process the request queues, the first connection handles ordered requests first
+            // Requests are taken one at a time so idle connections can pick up the remaining requests
+            std::unique_ptr<Request> request;
+            while(mRunning && dequeue(connection, request))
             {
-                nap::Logger::warn("Unsupported type for parameter copy: " + param->getRepresentedType().get_name().to_string());
-                continue;
+                if(connection.mPipeline == nullptr)
+                {
+                    // Send the request and hand it to its executor for completion
+                    request->mSuccess = perform(connection, *request);
+                    dispatch(std::move(request));
+                    continue;
+                }
+
+                // Write up to the pipeline depth of queued requests back to back, responses arrive in order
+                std::vector<std::unique_ptr<Request>> batch;
+                batch.emplace_back(std::move(request));
+                while(static_cast<int>(batch.size()) < mPipelineDepth && dequeue(connection, request))
+                    batch.emplace_back(std::move(request));
+
+                sendPipelined(connection, batch);
+                for(auto& completed : batch)
+                    dispatch(std::move(completed));
             }
-            copyValueMap[param->getRepresentedType()](copy, *param);
         }
-        return std::move(copy);
     }
 
 
-    template<typename T>
-    static void addValue(std::vector<std::unique_ptr<APIBaseValue>>& copy, APIBaseValue& value)
+    bool RestClient::dequeue(Connection& connection, std::unique_ptr<Request>& request)
     {
-        copy.emplace_back(std::make_unique<APIValue<T>>(*static_cast<APIValue<T>*>(&value)));
+        // Ordered requests first, then the lanes from high to low priority, cancelled requests are dropped
+        while(true)
+        {
+            bool found = connection.mIndex == 0 && mOrderedRequestQueue.try_dequeue(request);
+            for(auto lane = mRequestQueues.rbegin(); lane != mRequestQueues.rend() && !found; ++lane)
+                found = lane->try_dequeue(request);
+
+            if(!found)
+                return false;
+
+            if(!mImpl->drop(*request))
+                return true;
+            mCancelledCount++;
+
+            // Let the download know its segment won't be sent
+            if(request->mOnSent)
+            {
+                request->mErrorState.fail("Request cancelled");
+                execute(std::move(request));
+            }
+        }
     }
 
+    ////////////////////////////////////////////////////////////////////////////
+    //// Helper functions
+    ////////////////////////////////////////////////////////////////////////////
 
     template<typename T>
     static std::string toHTTPParam(const APIValue<T>& value)
@@ -351,4 +2161,139 @@ namespace nap
         }
         return http_headers;
     }
+
+
+    static void configure(httplib::Client& client, const std::string& certPath, int timeOutSeconds, bool keepAlive)
+    {
+        client.set_ca_cert_path("", certPath);
+        if(timeOutSeconds > 0)
+        {
+            client.set_connection_timeout(timeOutSeconds, 0);
+            client.set_read_timeout(timeOutSeconds, 0);
+            client.set_write_timeout(timeOutSeconds, 0);
+        }
+        client.set_keep_alive(keepAlive);
+    }
+
+
+    static std::string toHTTPTarget(const std::string& address, const httplib::Params& params)
+    {
+        if(params.empty())
+            return address;
+        return address + (address.find('?') == std::string::npos ? '?' : '&') + httplib::detail::params_to_query_str(params);
+    }
+
+
+    static httplib::Result sendBody(httplib::Client& client, const std::string& method, const std::string& target, httplib::Headers headers, const RestRequestBody& body,
+                                    int compressionThreshold, const std::function<bool()>& isAbandoned, uint64_t& contentSize, uint64_t& wireSize)
+    {
+        // Owned and borrowed bodies are written to the connection straight from their memory, httplib copies bodies that are passed as data
+        httplib::ContentProvider provider;
+        uint64_t size = body.mSize;
+        std::string compressed;
+        if(!body.isStreamed())
+        {
+            const char* data = body.mView != nullptr ? body.mView : body.mData.data();
+            size = body.mView != nullptr ? body.mSize : body.mData.size();
+            contentSize = size;
+
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+            // Large bodies are compressed on the worker thread, they are sent as is when compression doesn't pay off
+            if(compressionThreshold > 0 && size >= static_cast<uint64_t>(compressionThreshold) && headers.find("Content-Encoding") == headers.end())
+            {
+                httplib::detail::gzip_compressor compressor;
+                bool compressed_body = compressor.compress(data, size, true, [&compressed](const char* chunk, size_t length)
+                {
+                    compressed.append(chunk, length);
+                    return true;
+                });
+                if(compressed_body && compressed.size() < size)
+                {
+                    data = compressed.data();
+                    size = compressed.size();
+                    headers.emplace("Content-Encoding", "gzip");
+                }
+            }
+#endif
+            wireSize = size;
+            provider = [data, &isAbandoned](size_t offset, size_t length, httplib::DataSink& sink)
+            {
+                return !isAbandoned() && sink.write(data + offset, length);
+            };
+        }
+        else if(size > 0)
+        {
+            contentSize = wireSize = size;
+            provider = [&body, &isAbandoned](size_t offset, size_t, httplib::DataSink& sink)
+            {
+                // A provider that writes nothing would stall the request
+                size_t written = 0;
+                bool proceed = !isAbandoned() && body.mProvider(offset, [&sink, &written](const char* data, size_t size)
+                {
+                    written += size;
+                    return sink.write(data, size);
+                });
+                return proceed && written > 0;
+            };
+        }
+        else
+        {
+            // The size is unknown, the body is sent with chunked transfer encoding and ends when the provider writes nothing
+            httplib::ContentProviderWithoutLength chunked = [&body, &isAbandoned, &contentSize, &wireSize](size_t offset, httplib::DataSink& sink)
+            {
+                contentSize = wireSize = offset;
+                size_t written = 0;
+                if(isAbandoned() || !body.mProvider(offset, [&sink, &written](const char* data, size_t size)
+                {
+                    written += size;
+                    return sink.write(data, size);
+                }))
+                {
+                    return false;
+                }
+
+                if(written == 0)
+                    sink.done();
+                return true;
+            };
+
+            if(method == "POST")
+                return client.Post(target, headers, std::move(chunked), body.mContentType);
+            if(method == "PUT")
+                return client.Put(target, headers, std::move(chunked), body.mContentType);
+            return client.Patch(target, headers, std::move(chunked), body.mContentType);
+        }
+
+        if(method == "POST")
+            return client.Post(target, headers, size, std::move(provider), body.mContentType);
+        if(method == "PUT")
+            return client.Put(target, headers, size, std::move(provider), body.mContentType);
+        return client.Patch(target, headers, size, std::move(provider), body.mContentType);
+    }
+
+
+    static uint64_t getWireSize(const httplib::Response& response, uint64_t contentSize)
+    {
+        // The content length is the size of the encoded body, chunked bodies don't report it and count as they were decoded
+        return response.has_header("Content-Length") ? response.get_header_value_u64("Content-Length") : contentSize;
+    }
+
+
+    static void toRestResponse(httplib::Response& response, RestCache* cache, const std::string& cacheKey, RestResponse& output)
+    {
+        // Store cacheable responses, the body is moved into the cache and shared with the response
+        if(cache != nullptr)
+        {
+            auto stored = cache->store(cacheKey, response);
+            if(stored != nullptr)
+            {
+                output.setData(stored->mData);
+                output.mContentType = stored->mContentType;
+                return;
+            }
+        }
+
+        output.setData(std::move(response.body));
+        output.mContentType = response.get_header_value("Content-Type");
+    }
 }
@@ -1,12 +1,17 @@
 #pragma once
 
 #include <nap/device.h>
+#include <nap/resourceptr.h>
+#include <array>
 #include <atomic>
 #include <thread>
 
 #include "restresponse.h"
+#include "restcache.h"
+#include "restfunction.h"
 #include "concurrentqueue.h"
 #include <apivalue.h>
+#include <rapidjson/fwd.h>
 #include "utility/autoresetevent.h"
 
 namespace nap
@@ -23,10 +28,245 @@ namespace nap
         std::string value; ///< Property : 'Value' The value of the header
     };
 
+    /**
+     * Where the success and error callbacks of a request are executed
+     */
+    enum class ERestCallbackExecutor : int
+    {
+        MainThread  = 0,    ///< On the main thread, during the update loop of the RestService
+        Worker      = 1,    ///< Inline on the client worker thread, as soon as the response arrives
+        Custom      = 2     ///< Handed to the custom executor of the request
+    };
+
+    /**
+     * Priority of a request, queued requests with a higher priority are sent first
+     */
+    enum class ERestRequestPriority : int
+    {
+        Low         = 0,    ///< Background work, such as prefetches
+        Normal      = 1,    ///< Default priority
+        High        = 2     ///< User visible requests
+    };
+
+    // Receives a chunk of a streamed response body on the client worker thread, return false to abort the request
+    using RestContentReceiver = std::function<bool(const char* data, size_t size)>;
+
+    // Writes the next part of a streamed request body on the client worker thread, starting at the given offset.
+    // Write one or more chunks to the sink and return true, return false to abort the request.
+    // Every call must write at least one byte, a body without a size ends when the provider writes nothing.
+    using RestContentProvider = std::function<bool(uint64_t offset, const RestContentReceiver& sink)>;
+
+    // Executes a task, used to run request callbacks on a user supplied executor
+    using RestExecutor = std::function<void(std::function<void()>)>;
+
+    /**
+     * The body of a post, put or patch request.
+     * The body is either owned by the request, borrowed from the caller or streamed by a provider.
+     * Owned and borrowed bodies are written to the connection straight from their memory, they are never copied by the client.
+     */
+    struct NAPAPI RestRequestBody
+    {
+        // Default constructor, an empty body
+        RestRequestBody() = default;
+
+        /**
+         * Owned body, such as a JSON document
+         * @param data the body, moved into the request
+         * @param contentType the content type of the body
+         */
+        RestRequestBody(std::string data, std::string contentType = "application/json") :
+            mData(std::move(data)), mContentType(std::move(contentType)) { }
+
+        /**
+         * Borrowed body, the memory must stay valid until the request completes or is cancelled
+         * @param data the body
+         * @param size the size of the body in bytes
+         * @param contentType the content type of the body
+         */
+        RestRequestBody(const void* data, size_t size, std::string contentType = "application/octet-stream") :
+            mView(static_cast<const char*>(data)), mSize(size), mContentType(std::move(contentType)) { }
+
+        /**
+         * Streamed body, the provider is called on the client worker thread while the request is sent
+         * @param provider writes the body in chunks
+         * @param size the size of the body in bytes, 0 when unknown, in which case the body is sent with chunked transfer encoding
+         * @param contentType the content type of the body
+         */
+        RestRequestBody(RestContentProvider provider, uint64_t size, std::string contentType = "application/octet-stream") :
+            mSize(size), mProvider(std::move(provider)), mContentType(std::move(contentType)) { }
+
+        /**
+         * @return if the body is written by a provider
+         */
+        bool isStreamed() const { return mProvider != nullptr; }
+
+        std::string mData;                          ///< The owned body
+        const char* mView = nullptr;                ///< The borrowed body, not owned
+        uint64_t mSize = 0;                         ///< The size of a borrowed or streamed body
+        RestContentProvider mProvider;              ///< Writes a streamed body
+        std::string mContentType;                   ///< The content type of the body
+    };
+
+    /**
+     * Options that apply to a single request
+     */
+    struct NAPAPI RestRequestOptions
+    {
+        bool mOrdered = false; ///< Ordered requests are sent one after the other, in the order they are made, and complete in that order
+        ERestCallbackExecutor mExecutor = ERestCallbackExecutor::MainThread; ///< Where the callbacks are executed, the main thread is the only thread that can safely access NAP state
+        RestExecutor mCustomExecutor = nullptr; ///< Executes the callbacks when the executor is set to custom, called from the client worker thread
+        ERestRequestPriority mPriority = ERestRequestPriority::Normal; ///< Queued requests with a higher priority are sent first, ordered requests are always sent in order
+    };
+
+    /**
+     * Options that apply to a single download, on top of the request options
+     */
+    struct NAPAPI RestDownloadOptions : public RestRequestOptions
+    {
+        int mSegments = 4; ///< Maximum number of Range requests the file is fetched with in parallel, 1 fetches the file with a single request
+        int mMinSegmentSize = 4 * 1024 * 1024; ///< Minimum number of bytes of a segment, smaller files are fetched with fewer segments
+        bool mResume = true; ///< Continue from the partial file left behind by an interrupted download of the same file
+    };
+
+    /**
+     * The outcome of a completed download
+     */
+    struct NAPAPI RestDownloadResult
+    {
+        std::string mPath; ///< The path of the downloaded file
+        std::string mContentType; ///< The content type of the file
+        uint64_t mSize = 0; ///< The size of the file in bytes
+        uint64_t mResumedBytes = 0; ///< Bytes that were downloaded by an earlier, interrupted download
+        int mSegments = 1; ///< Number of segments the file was fetched in
+    };
+
+    /**
+     * A get request of a batch
+     */
+    struct NAPAPI RestBatchRequest
+    {
+        std::string mAddress; ///< The address to send the request to
+        std::vector<std::unique_ptr<APIBaseValue>> mParams; ///< The parameters to send with the request
+    };
+
+    /**
+     * Options that apply to a batch, on top of the request options that apply to every request of the batch
+     */
+    struct NAPAPI RestBatchOptions : public RestRequestOptions
+    {
+        int mMaxConcurrency = 0; ///< Maximum number of requests of the batch that are queued or in flight at the same time, 0 means no limit
+    };
+
+    /**
+     * The outcome of a single request of a batch
+     */
+    struct NAPAPI RestBatchResult
+    {
+        bool mSuccess = false; ///< If the request succeeded, the response is only valid when it did
+        RestResponse mResponse; ///< The response to the request
+        utility::ErrorState mErrorState; ///< Why the request failed
+        float mStart = 0.0f; ///< Milliseconds between making the batch and queueing the request
+        float mDuration = 0.0f; ///< Milliseconds between queueing the request and its completion
+    };
+
+    /**
+     * Handle to a request made with RestClient::get, used to cancel the request.
+     * Copies refer to the same request, the handle can be discarded when the request does not need to be cancelled.
+     */
+    class NAPAPI RestRequestHandle final
+    {
+        friend class RestClient;
+    public:
+        // Default constructor, creates an invalid handle
+        RestRequestHandle() = default;
+
+        /**
+         * Cancels the request, the callbacks of a cancelled request are not called.
+         * A queued request is dropped without being sent, a request that is being sent is aborted.
+         * Requests that are attached to an identical request keep the shared request going.
+         * Safe to call from any thread and more than once.
+         */
+        void cancel();
+
+        /**
+         * @return if the request has been cancelled
+         */
+        bool isCancelled() const;
+
+        /**
+         * @return if the handle refers to a request
+         */
+        bool isValid() const { return mState != nullptr; }
+
+    private:
+        struct State;
+        RestRequestHandle(std::shared_ptr<State> state) : mState(std::move(state)) { }
+        std::shared_ptr<State> mState;
+    };
+
+    /**
+     * When and how often a failed request is sent again
+     * The delay before attempt n is InitialDelay * Multiplier^(n - 2), capped at MaxDelay, of which a random fraction (Jitter) is dropped
+     * so clients that failed at the same time don't retry at the same time.
+     */
+    struct NAPAPI RestRetryPolicy
+    {
+        int mMaxAttempts = 1; ///< Property : 'MaxAttempts' Maximum number of times a request is sent, 1 disables retrying
+        int mInitialDelay = 100; ///< Property : 'InitialDelay' Delay in milliseconds before the first retry
+        int mMaxDelay = 5000; ///< Property : 'MaxDelay' Maximum delay in milliseconds between attempts, also caps the Retry-After of the upstream
+        float mMultiplier = 2.0f; ///< Property : 'Multiplier' Factor the delay grows with after every attempt
+        float mJitter = 0.5f; ///< Property : 'Jitter' Fraction of the delay (0-1) that is randomized
+        std::vector<int> mStatusCodes = {408, 429, 500, 502, 503, 504}; ///< Property : 'StatusCodes' Response status codes that are retried
+        bool mConnectionErrors = true; ///< Property : 'ConnectionErrors' Retry when the connection can't be made or times out
+        bool mTransferErrors = true; ///< Property : 'TransferErrors' Retry when the connection fails while sending the request or receiving the response
+    };
+
+    /**
+     * Stops sending requests to an upstream that keeps failing.
+     * After FailureThreshold consecutive failed requests the circuit opens and new requests fail right away, without being queued.
+     * After OpenDuration the circuit lets ProbeCount requests through: when they succeed the circuit closes, when one fails it opens again.
+     * A request counts as failed when it could not be completed or the upstream answered with a status code the retry policy retries.
+     */
+    struct NAPAPI RestCircuitBreakerPolicy
+    {
+        bool mEnabled = false; ///< Property : 'Enabled' If the circuit breaker is enabled
+        int mFailureThreshold = 5; ///< Property : 'FailureThreshold' Number of consecutive failed requests that opens the circuit
+        float mOpenDuration = 10.0f; ///< Property : 'OpenDuration' Number of seconds the circuit stays open before it is probed
+        int mProbeCount = 1; ///< Property : 'ProbeCount' Number of requests let through to probe the upstream
+    };
+
+    /**
+     * Sends a duplicate of a slow request to cut the tail latency of a client.
+     * When a request did not complete within the given percentile of recently observed latencies,
+     * the same request is sent on the hedge connection that every connection owns. The first response wins, the other request is cancelled.
+     * Only a fraction (MaxRate) of all requests is allowed to be hedged, requests are only hedged once enough latencies are observed.
+     */
+    struct NAPAPI RestHedgePolicy
+    {
+        bool mEnabled = false; ///< Property : 'Enabled' If slow requests are hedged
+        float mPercentile = 95.0f; ///< Property : 'Percentile' Latency percentile (0-100) after which a request is hedged
+        int mMinDelay = 5; ///< Property : 'MinDelay' Minimum time in milliseconds before a request is hedged
+        float mMaxRate = 0.05f; ///< Property : 'MaxRate' Maximum fraction (0-1) of requests that is hedged
+        int mWindow = 256; ///< Property : 'Window' Number of recent latencies the percentile is computed over, it is recomputed each time a 16th of the window was replaced
+        int mMinSamples = 32; ///< Property : 'MinSamples' Number of latencies that must be observed before requests are hedged
+    };
+
+    /**
+     * State of the circuit breaker of a client
+     */
+    enum class ERestCircuitState : int
+    {
+        Closed      = 0,    ///< Requests are sent
+        Open        = 1,    ///< Requests fail right away
+        HalfOpen    = 2     ///< A limited number of requests is sent to probe the upstream
+    };
+
     /**
      * A RestClient can make an http request.
-     * It has its own worker thread to handle requests. Requests will be put into a queue as long as the previous request has not returned
-     * Success and Error callbacks will always be called on the main thread from the RestService update loop
+     * It has a worker thread for every connection to handle requests. Requests will be put into a queue as long as all connections are busy.
+     * Requests are not guaranteed to complete in the order they are made, unless they are marked as ordered in the RestRequestOptions.
+     * Success and Error callbacks are called on the main thread from the RestService update loop,
+     * unless a different executor is selected in the RestRequestOptions.
      */
     class NAPAPI RestClient final : public Device
     {
@@ -50,7 +290,7 @@ namespace nap
         bool init(nap::utility::ErrorState& errorState) final;
 
         /**
-         * Starts the worker thread
+         * Starts the worker threads, one for every connection
          * Registers the client with the service
          * @param errorState contains the error state
          * return true on success
@@ -58,7 +298,7 @@ namespace nap
         bool start(nap::utility::ErrorState& errorState) final;
 
         /**
-         * Stops the worker thread
+         * Stops the worker threads
          * Removes the client from the service
          */
         void stop() final;
@@ -69,14 +309,200 @@ namespace nap
          * @param params the parameters to send with the request
          * @param onSuccess on success callback
          * @param onError on error callback
+         * @param options request options
+         * @return handle to the request, used to cancel the request
          */
-        void get(const std::string& address,
+        RestRequestHandle get(const std::string& address,
                  const std::vector<std::unique_ptr<APIBaseValue>>& params,
                  std::function<void(const RestResponse& response)> onSuccess,
-                 std::function<void(const utility::ErrorState&)> onError);
+                 std::function<void(const utility::ErrorState&)> onError,
+                 const RestRequestOptions& options = {});
+
+        /**
+         * Sends a get request, non-blocking, streams the response body to the receiver instead of buffering it.
+         * Chunks are delivered to the receiver on the client worker thread as they arrive, return false from the receiver to abort the request.
+         * The success callback receives a response without data once the last chunk is delivered, callbacks are executed according to the options.
+         * Streamed requests are not cached, hedged, pipelined or attached to identical requests, and are only retried when no data was delivered yet.
+         * @param address the address to send the request to
+         * @param params the parameters to send with the request
+         * @param onData receives the chunks of the response body, called from a client worker thread
+         * @param onSuccess on success callback
+         * @param onError on error callback
+         * @param options request options
+         * @return handle to the request, used to cancel the request
+         */
+        RestRequestHandle getStream(const std::string& address,
+                                    const std::vector<std::unique_ptr<APIBaseValue>>& params,
+                                    RestContentReceiver onData,
+                                    std::function<void(const RestResponse& response)> onSuccess,
+                                    std::function<void(const utility::ErrorState&)> onError,
+                                    const RestRequestOptions& options = {});
+
+        /**
+         * Sends a get request, non-blocking, parses the response body as JSON on the client worker thread.
+         * The document is parsed into a document and memory that are reused by later requests, callbacks are executed according to the options.
+         * The document is only valid until the success callback returns, copy the values you need to keep.
+         * A body that is not valid JSON fails the request with the parse error and its offset.
+         * @param address the address to send the request to
+         * @param params the parameters to send with the request
+         * @param onSuccess on success callback, receives the root of the parsed document
+         * @param onError on error callback
+         * @param options request options
+         * @return handle to the request, used to cancel the request
+         */
+        RestRequestHandle getJson(const std::string& address,
+                                  const std::vector<std::unique_ptr<APIBaseValue>>& params,
+                                  std::function<void(const rapidjson::Value& document)> onSuccess,
+                                  std::function<void(const utility::ErrorState&)> onError,
+                                  const RestRequestOptions& options = {});
+
+        /**
+         * Sends a get request, non-blocking, extracts the values at the given JSON Pointer paths from the response body on the client worker thread.
+         * The body is run through a SAX parser as it arrives, no document is built. The transfer stops as soon as all paths are resolved.
+         * Values are delivered as typed values keyed by their path: bool, int, int64_t, double or std::string.
+         * Paths that are not found, or that refer to an object, array or null, are missing from the values.
+         * The request is streamed: it is not cached, hedged, pipelined or attached to identical requests, and only retried when no data was received yet.
+         * @param address the address to send the request to
+         * @param params the parameters to send with the request
+         * @param pointers the JSON Pointer paths (RFC 6901) to extract, such as "/data/0/name"
+         * @param onSuccess on success callback, receives the extracted values
+         * @param onError on error callback, also called when a path is invalid or the body is not valid JSON
+         * @param options request options
+         * @return handle to the request, used to cancel the request
+         */
+        RestRequestHandle getJsonValues(const std::string& address,
+                                        const std::vector<std::unique_ptr<APIBaseValue>>& params,
+                                        const std::vector<std::string>& pointers,
+                                        std::function<void(const RestValueMap& values)> onSuccess,
+                                        std::function<void(const utility::ErrorState&)> onError,
+                                        const RestRequestOptions& options = {});
 
         /**
-         * Sends a blocking get request
+         * Sends a get request, non-blocking, reads the JSON response body into a new object of the given RTTI type on the client worker thread.
+         * JSON members are matched to the properties of the type by name, members without a matching property are skipped.
+         * The property table of a type is built once and cached, the finished object is handed to the success callback.
+         * A body that is not valid JSON or doesn't fit the type fails the request with the path of the offending member.
+         * @tparam T the RTTI type to read the response into, must be default constructible
+         * @param address the address to send the request to
+         * @param params the parameters to send with the request
+         * @param onSuccess on success callback, receives ownership of the object
+         * @param onError on error callback
+         * @param options request options
+         * @return handle to the request, used to cancel the request
+         */
+        template<typename T>
+        RestRequestHandle getObject(const std::string& address,
+                                    const std::vector<std::unique_ptr<APIBaseValue>>& params,
+                                    std::function<void(std::unique_ptr<T> object)> onSuccess,
+                                    std::function<void(const utility::ErrorState&)> onError,
+                                    const RestRequestOptions& options = {});
+
+        /**
+         * Sends a post request, non-blocking, callbacks are executed according to the options.
+         * Requests that carry a body are queued, dispatched and sent with the client headers like get requests.
+         * Post and patch requests are not idempotent and are never retried, none of them are cached, hedged, pipelined or attached to identical requests.
+         * A successful request removes the cached response of a get request to the same address.
+         * @param address the address to send the request to
+         * @param params the parameters to add to the query of the request
+         * @param body the body of the request
+         * @param onSuccess on success callback
+         * @param onError on error callback
+         * @param options request options
+         * @return handle to the request, used to cancel the request
+         */
+        RestRequestHandle post(const std::string& address,
+                               const std::vector<std::unique_ptr<APIBaseValue>>& params,
+                               RestRequestBody body,
+                               std::function<void(const RestResponse& response)> onSuccess,
+                               std::function<void(const utility::ErrorState&)> onError,
+                               const RestRequestOptions& options = {});
+
+        /**
+         * Sends a put request, non-blocking, see post. Put requests with an owned or borrowed body are retried according to the retry policy.
+         * @param address the address to send the request to
+         * @param params the parameters to add to the query of the request
+         * @param body the body of the request
+         * @param onSuccess on success callback
+         * @param onError on error callback
+         * @param options request options
+         * @return handle to the request, used to cancel the request
+         */
+        RestRequestHandle put(const std::string& address,
+                              const std::vector<std::unique_ptr<APIBaseValue>>& params,
+                              RestRequestBody body,
+                              std::function<void(const RestResponse& response)> onSuccess,
+                              std::function<void(const utility::ErrorState&)> onError,
+                              const RestRequestOptions& options = {});
+
+        /**
+         * Sends a patch request, non-blocking, see post.
+         * @param address the address to send the request to
+         * @param params the parameters to add to the query of the request
+         * @param body the body of the request
+         * @param onSuccess on success callback
+         * @param onError on error callback
+         * @param options request options
+         * @return handle to the request, used to cancel the request
+         */
+        RestRequestHandle patch(const std::string& address,
+                                const std::vector<std::unique_ptr<APIBaseValue>>& params,
+                                RestRequestBody body,
+                                std::function<void(const RestResponse& response)> onSuccess,
+                                std::function<void(const utility::ErrorState&)> onError,
+                                const RestRequestOptions& options = {});
+
+        /**
+         * Sends a delete request, non-blocking, see post. Delete requests are retried according to the retry policy.
+         * @param address the address to send the request to
+         * @param params the parameters to add to the query of the request
+         * @param onSuccess on success callback
+         * @param onError on error callback
+         * @param options request options
+         * @return handle to the request, used to cancel the request
+         */
+        RestRequestHandle del(const std::string& address,
+                              const std::vector<std::unique_ptr<APIBaseValue>>& params,
+                              std::function<void(const RestResponse& response)> onSuccess,
+                              std::function<void(const utility::ErrorState&)> onError,
+                              const RestRequestOptions& options = {});
+
+        /**
+         * Downloads a file, non-blocking, the body is written straight to disk instead of being buffered.
+         * When the upstream accepts Range requests the file is split into segments that are fetched in parallel over the connections of the client,
+         * every segment is written at its own position in the file. The file is written to '<path>.part' and moved to the path once complete.
+         * The progress of an interrupted download is stored next to the partial file, a later download of the same, unchanged file continues from there.
+         * Callbacks are executed according to the options, downloads are never ordered. Cancelling the download aborts all segments and keeps the partial file.
+         * @param address the address to send the request to
+         * @param params the parameters to send with the request
+         * @param path the path to write the file to
+         * @param onSuccess on success callback
+         * @param onError on error callback
+         * @param options download options
+         * @return handle to the download, used to cancel the download
+         */
+        RestRequestHandle download(const std::string& address,
+                                   const std::vector<std::unique_ptr<APIBaseValue>>& params,
+                                   const std::string& path,
+                                   std::function<void(const RestDownloadResult& result)> onSuccess,
+                                   std::function<void(const utility::ErrorState&)> onError,
+                                   const RestDownloadOptions& options = {});
+
+        /**
+         * Sends a batch of get requests, non-blocking, completes once with the results of all requests.
+         * The requests are spread over the connections of the client, at most MaxConcurrency of them are queued or in flight at the same time.
+         * The results are in the order of the requests, a failed request doesn't fail the batch. The completion is executed according to the options.
+         * Cancelling the batch aborts the requests in flight and drops the others, the completion of a cancelled batch is not called.
+         * @param requests the requests to send
+         * @param onComplete called with the results of all requests, in the order of the requests
+         * @param options batch options, the request options apply to every request, batches are never ordered
+         * @return handle to the batch, used to cancel the batch
+         */
+        RestRequestHandle getBatch(const std::vector<RestBatchRequest>& requests,
+                                   std::function<void(const std::vector<RestBatchResult>& results)> onComplete,
+                                   const RestBatchOptions& options = {});
+
+        /**
+         * Sends a blocking get request, uses the first connection.
          * @param address the address to send the request to
          * @param params the parameters to send with the request
          * @param response response object to fill with the response
@@ -94,32 +520,230 @@ namespace nap
         std::string mArraySeparator = ","; ///< Property : 'ArraySeparator' The separator used for arrays in the URL
         std::vector<RestHeader> mHeaders = {{"User-Agent", "NAP/1.0"}}; ///< Property : 'Headers' The headers to send with the request
         int mTimeOutSeconds = 0; ///< Property : 'TimeOutSeconds' The timeout in seconds for the request
+        int mConnections = 1; ///< Property : 'Connections' The number of connections, each connection has its own worker thread
+        bool mKeepAlive = true; ///< Property : 'KeepAlive' Keep connections open between requests, avoids a new TCP and TLS handshake for every request
+        int mIdleTimeOutSeconds = 30; ///< Property : 'IdleTimeout' Connections that are idle for longer than this number of seconds are reopened before the next request, 0 means never
+        bool mWarmUp = false; ///< Property : 'WarmUp' Open (and for https, handshake) all connections when the client starts
+        std::string mWarmUpAddress = "/"; ///< Property : 'WarmUpAddress' The address of the HEAD request used to warm up the connections
+        bool mPipelining = false; ///< Property : 'Pipelining' Write multiple queued requests back to back on a connection, plain http only, falls back when the upstream does not support it
+        int mPipelineDepth = 8; ///< Property : 'PipelineDepth' The maximum number of requests written back to back on a connection
+        bool mDeduplicate = true; ///< Property : 'Deduplicate' Attach requests to an identical request (same address and params) that is queued or in flight, instead of sending them again
+        RestRetryPolicy mRetry; ///< Property : 'Retry' When and how often failed requests are sent again
+        RestCircuitBreakerPolicy mCircuitBreaker; ///< Property : 'CircuitBreaker' Fails requests right away while the upstream keeps failing
+        RestHedgePolicy mHedge; ///< Property : 'Hedge' Sends a duplicate of requests that are slower than usual
+        ResourcePtr<RestCache> mCache; ///< Property : 'Cache' Optional response cache, fresh responses are served without a network round trip and stale responses are revalidated
+        bool mCompression = true; ///< Property : 'Compression' Ask the upstream for compressed responses (gzip and deflate with zlib, br with brotli), responses are decompressed on the worker thread
+        int mCompressionThreshold = 0; ///< Property : 'CompressionThreshold' Owned and borrowed request bodies of at least this number of bytes are sent gzip compressed, 0 disables request compression, requires zlib
+
+        /**
+         * @return number of requests sent over a connection that was already open
+         */
+        uint64_t getReusedConnectionCount() const { return mReusedConnectionCount.load(); }
+
+        /**
+         * @return number of requests that opened a new connection
+         */
+        uint64_t getNewConnectionCount() const { return mNewConnectionCount.load(); }
+
+        /**
+         * @return number of requests that were attached to an identical request instead of being sent
+         */
+        uint64_t getDeduplicatedCount() const { return mDeduplicatedCount.load(); }
+
+        /**
+         * @return number of times a failed request was sent again
+         */
+        uint64_t getRetryCount() const { return mRetryCount.load(); }
+
+        /**
+         * @return number of requests failed right away by the circuit breaker
+         */
+        uint64_t getRejectedCount() const { return mRejectedCount.load(); }
+
+        /**
+         * @return number of cancelled requests that were dropped without being sent
+         */
+        uint64_t getCancelledCount() const { return mCancelledCount.load(); }
+
+        /**
+         * @return number of hedge requests sent
+         */
+        uint64_t getHedgeCount() const { return mHedgeCount.load(); }
+
+        /**
+         * @return number of hedge requests that completed before the original request
+         */
+        uint64_t getHedgeWinCount() const { return mHedgeWinCount.load(); }
+
+        /**
+         * @return fraction of requests that were hedged, 0 when hedging is disabled
+         */
+        float getHedgeRate() const;
+
+        /**
+         * @return number of request and response body bytes as they were transferred, compressed when the transfer was compressed
+         */
+        uint64_t getCompressedByteCount() const { return mCompressedByteCount.load(); }
+
+        /**
+         * @return number of request and response body bytes before compression and after decompression
+         */
+        uint64_t getUncompressedByteCount() const { return mUncompressedByteCount.load(); }
+
+        /**
+         * @return the current state of the circuit breaker, always closed when the circuit breaker is disabled
+         */
+        ERestCircuitState getCircuitState() const;
 
         // Signals
         // Progress signal is dispatched on main thread when progress is reported, first int is bytes received second int is total bytes to receive
+        // Progress is sampled once per update, the signal is dispatched at most once per frame for every request with the latest values
         Signal<uint64_t, uint64_t> mProgressSignal;
     private:
-        // Called by the service
+        // Called by the service, reports the progress of requests in flight
         void update(double deltaTime);
 
-        // Threading
-        std::atomic_bool mRunning = {false};
-        void run();
+        // Called by the service, runs a single main thread task or completes a single handled request, returns false when there is nothing left
+        bool complete();
 
-        std::thread mThread;
-        moodycamel::ConcurrentQueue<std::function<void()>> mCallbackQueue;
-        moodycamel::ConcurrentQueue<std::function<void()>> mRequestQueue;
-        utility::AutoResetEvent mRequestEvent;
+        // Called by the service, returns the approximate number of main thread tasks and handled requests waiting
+        size_t getPendingCount() const;
 
         // httplib implementation
         struct Impl;
         std::unique_ptr<Impl> mImpl;
 
+        // A connection and its worker thread
+        struct Connection;
+
+        // A request, owned by the queue or worker that is currently handling it
+        struct Request;
+
+        // A move-only task that runs on the main thread, owns the state it runs on
+        struct Task;
+
+        // A download and its segments, shared by the requests of the download
+        struct Download;
+
+        // The requests of a batch and their results, shared by the requests of the batch
+        struct Batch;
+
+        // Connection reuse counters
+        std::atomic<uint64_t> mReusedConnectionCount = {0};
+        std::atomic<uint64_t> mNewConnectionCount = {0};
+        std::atomic<uint64_t> mDeduplicatedCount = {0};
+        std::atomic<uint64_t> mRetryCount = {0};
+        std::atomic<uint64_t> mRejectedCount = {0};
+        std::atomic<uint64_t> mHedgeCount = {0};
+        std::atomic<uint64_t> mCancelledCount = {0};
+        std::atomic<uint64_t> mHedgeWinCount = {0};
+        std::atomic<uint64_t> mCompressedByteCount = {0};
+        std::atomic<uint64_t> mUncompressedByteCount = {0};
+
+        // Threading
+        std::atomic_bool mRunning = {false};
+        void run(Connection& connection);
+
+        // Sends the duplicate of a slow request on the hedge connection of the given connection
+        void runHedge(Connection& connection);
+
+        // Queues a request, or attaches it to an identical request, returns the handle of the request
+        RestRequestHandle submit(std::unique_ptr<Request> request, const RestRequestOptions& options);
+
+        // Queues a get request that reads the response into the given instance on the worker, the success callback takes the finished object
+        RestRequestHandle submitObject(const std::string& address, const std::vector<std::unique_ptr<APIBaseValue>>& params, const rtti::Instance& object,
+                                       std::function<void()> onSuccess, std::function<void(const utility::ErrorState&)> onError, const RestRequestOptions& options);
+
+        // Queues a request with the given method and body
+        RestRequestHandle submitBody(const char* method, const std::string& address, const std::vector<std::unique_ptr<APIBaseValue>>& params, RestRequestBody body,
+                                     std::function<void(const RestResponse&)> onSuccess, std::function<void(const utility::ErrorState&)> onError, const RestRequestOptions& options);
+
+        // Adds a request to the queue of its priority and wakes up the workers
+        void enqueue(std::unique_ptr<Request> request, bool ordered);
+
+        // Splits a download into segments once the upstream described the file, called on the worker that sent the probe
+        void startDownload(const std::shared_ptr<Download>& download, const Request& probe);
+
+        // Records a finished segment, completes the download when it was the last one
+        void finishSegment(Download& download, const Request& segment);
+
+        // Moves a complete download into place, or stores its progress, and hands the outcome to the executor of the download
+        void completeDownload(Download& download);
+
+        // Queues the request of a batch at the given index
+        void startBatchItem(const std::shared_ptr<Batch>& batch, size_t index);
+
+        // Records the result of a request of a batch, queues the next request, completes the batch when it was the last one
+        void finishBatchItem(const std::shared_ptr<Batch>& batch, size_t index, Request& request);
+
+        // Hands the results of a batch to the executor of the batch
+        void completeBatch(Batch& batch);
+
+        // Wakes up the workers that can handle the next request
+        void notifyWorkers(bool ordered);
+
+        // Sends a request using the given connection, fills the response or error state of the request
+        bool send(Connection& connection, Request& request);
+
+        // Sends a request, retrying according to the retry policy, fails right away when the circuit is open
+        bool perform(Connection& connection, Request& request);
+
+        // Waits before the next attempt, returns false when the client stops while waiting
+        bool backOff(Request& request, int attempt);
+
+        // Takes the next request for the given connection from the queues
+        bool dequeue(Connection& connection, std::unique_ptr<Request>& request);
+
+        // Sends the requests back to back over the pipeline of the connection, falls back to regular requests
+        // Pipelined requests report progress and count towards the reuse counters like regular requests.
+        // Cancelling a pipelined request aborts the pipeline once none of the requests on it is needed anymore.
+        void sendPipelined(Connection& connection, std::vector<std::unique_ptr<Request>>& requests);
+
+        // Returns the key of the request in the response cache, made of the URL, the target and the headers of the client
+        std::string getCacheKey(const Request& request) const;
+
+        // Closes the connection when it has been idle for too long, updates the reuse counters
+        void prepare(Connection& connection);
+
+        // Closes the pipeline of the connection when it has been idle for too long, updates the reuse counters for the given number of requests
+        void preparePipeline(Connection& connection, size_t count);
+
+        // Opens the connection ahead of the first request
+        void warmUp(Connection& connection);
+
+        // Hands a sent request and the identical requests attached to it to their executors
+        void dispatch(std::unique_ptr<Request> request);
+
+        // Hands a sent request to the executor of the request
+        void execute(std::unique_ptr<Request> request);
+
+        // Reports the final progress of a request on the main thread, if it was not sampled yet
+        void flushProgress(Request& request);
+
+        moodycamel::ConcurrentQueue<std::unique_ptr<Task>> mCallbackQueue;             ///< Tasks to run on the main thread
+        std::array<moodycamel::ConcurrentQueue<std::unique_ptr<Request>>, 3> mRequestQueues;  ///< One lane per priority, indexed by ERestRequestPriority
+        moodycamel::ConcurrentQueue<std::unique_ptr<Request>> mOrderedRequestQueue;    ///< Only handled by the first connection
+        moodycamel::ConcurrentQueue<std::unique_ptr<Request>> mCompletionQueue;        ///< Handled requests, completed on the main thread
+
         // rest service reference
         RestService& mService;
-
-        std::unordered_map<std::string, std::vector<std::unique_ptr<APIBaseValue>>> mRequestParamsCache;
     };
 
     using RestClientObjectCreator = rtti::ObjectCreator<RestClient, RestService>;
+
+    //////////////////////////////////////////////////////////////////////////
+    //// RestClient Template Definitions
+    //////////////////////////////////////////////////////////////////////////
+
+    template<typename T>
+    RestRequestHandle RestClient::getObject(const std::string& address, const std::vector<std::unique_ptr<APIBaseValue>>& params, std::function<void(std::unique_ptr<T> object)> onSuccess,
+                                            std::function<void(const utility::ErrorState&)> onError, const RestRequestOptions& options)
+    {
+        // Filled on the worker through the instance, ownership moves to the caller on success
+        auto object = std::make_shared<std::unique_ptr<T>>(std::make_unique<T>());
+        return submitObject(address, params, rtti::Instance(**object), [object, on_success = std::move(onSuccess)]()
+        {
+            on_success(std::move(*object));
+        }, std::move(onError), options);
+    }
 }
\ No newline at end of file
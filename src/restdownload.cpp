@@ -0,0 +1,296 @@
+#include "restdownload.h"
+
+#include <nap/logger.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace nap
+{
+    // First line of the stored progress, bump when the format changes
+    static const std::string sStateMagic = "naprest-download-1";
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestDownloadFile
+    ////////////////////////////////////////////////////////////////////////////
+
+    RestDownloadFile::RestDownloadFile(std::string path) :
+        mPath(std::move(path)), mPartPath(mPath + ".part"), mStatePath(mPath + ".part.state")
+    {}
+
+
+    RestDownloadFile::~RestDownloadFile()
+    {
+        close();
+    }
+
+
+    bool RestDownloadFile::resume(const std::string& key, const std::string& validator, uint64_t size)
+    {
+        if(validator.empty() || size == 0)
+            return false;
+
+        // The stored progress is only trusted when it describes the same version of the same resource
+        std::ifstream file(mStatePath);
+        std::string magic, stored_key, stored_validator;
+        uint64_t stored_size = 0;
+        size_t count = 0;
+        std::getline(file, magic);
+        std::getline(file, stored_key);
+        std::getline(file, stored_validator);
+        file >> stored_size >> count;
+        if(!file || magic != sStateMagic || stored_key != key || stored_validator != validator || stored_size != size || count == 0)
+            return false;
+
+        std::error_code error;
+        if(std::filesystem::file_size(mPartPath, error) != size || error)
+            return false;
+
+        std::vector<std::unique_ptr<Segment>> segments;
+        uint64_t resumed = 0;
+        for(size_t i = 0; i < count; i++)
+        {
+            auto segment = std::make_unique<Segment>();
+            uint64_t received = 0;
+            file >> segment->mStart >> segment->mEnd >> received;
+            if(!file || segment->mStart > segment->mEnd || segment->mEnd > size || received > segment->mEnd - segment->mStart)
+                return false;
+            segment->mReceived = received;
+            resumed += received;
+            segments.emplace_back(std::move(segment));
+        }
+
+        utility::ErrorState error_state;
+        if(!open(false, error_state))
+            return false;
+
+        mKey = key;
+        mValidator = validator;
+        mSize = size;
+        mResumedBytes = resumed;
+        mSegments = std::move(segments);
+        return true;
+    }
+
+
+    bool RestDownloadFile::create(const std::string& key, const std::string& validator, uint64_t size, int segmentCount, utility::ErrorState& errorState)
+    {
+        std::error_code error;
+        std::filesystem::remove(mStatePath, error);
+        if(!open(true, errorState))
+            return false;
+
+        // Reserve the full size, segments are written out of order
+        if(!errorState.check(resize(size), "Unable to reserve %llu bytes for %s", static_cast<unsigned long long>(size), mPartPath.c_str()))
+        {
+            discard();
+            return false;
+        }
+
+        mKey = key;
+        mValidator = validator;
+        mSize = size;
+        mResumedBytes = 0;
+        mHasContentLength = false;
+        mSegments.clear();
+
+        // Split the file into equal segments, the last segment takes the remainder
+        uint64_t count = size > 0 ? std::max<uint64_t>(1, std::min<uint64_t>(segmentCount, size)) : 1;
+        uint64_t length = size / count;
+        for(uint64_t i = 0; i < count; i++)
+        {
+            auto segment = std::make_unique<Segment>();
+            segment->mStart = i * length;
+            segment->mEnd = i + 1 == count ? size : (i + 1) * length;
+            mSegments.emplace_back(std::move(segment));
+        }
+        save();
+        return true;
+    }
+
+
+    bool RestDownloadFile::write(Segment& segment, const char* data, size_t size)
+    {
+        uint64_t offset = segment.mStart + segment.mReceived.load();
+        if(segment.mEnd > 0 && offset + size > segment.mEnd)
+            return false;
+
+        if(!writeAt(offset, data, size))
+            return false;
+        segment.mReceived += size;
+        return true;
+    }
+
+
+    void RestDownloadFile::save()
+    {
+        // Without a validator a partial file can't be matched to the resource
+        if(mValidator.empty() || mSize == 0)
+            return;
+
+        // Written to a temporary file first, an interrupted save never leaves corrupt progress behind
+        std::lock_guard<std::mutex> lock(mStateMutex);
+        auto temp_path = mStatePath + ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::trunc);
+            file << sStateMagic << '\n' << mKey << '\n' << mValidator << '\n' << mSize << '\n' << mSegments.size() << '\n';
+            for(const auto& segment : mSegments)
+                file << segment->mStart << ' ' << segment->mEnd << ' ' << segment->mReceived.load() << '\n';
+            if(!file)
+            {
+                nap::Logger::warn("Unable to store download progress %s", temp_path.c_str());
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temp_path, mStatePath, error);
+        if(error)
+            nap::Logger::warn("Unable to store download progress %s : %s", mStatePath.c_str(), error.message().c_str());
+    }
+
+
+    bool RestDownloadFile::commit(utility::ErrorState& errorState)
+    {
+        close();
+
+        std::error_code error;
+        std::filesystem::rename(mPartPath, mPath, error);
+        if(!errorState.check(!error, "Unable to move %s to %s : %s", mPartPath.c_str(), mPath.c_str(), error.message().c_str()))
+            return false;
+
+        std::filesystem::remove(mStatePath, error);
+        return true;
+    }
+
+
+    void RestDownloadFile::discard()
+    {
+        close();
+
+        std::error_code error;
+        std::filesystem::remove(mPartPath, error);
+        std::filesystem::remove(mStatePath, error);
+    }
+
+
+    void RestDownloadFile::setContentLength(uint64_t length)
+    {
+        mContentLength = length;
+        mHasContentLength = true;
+    }
+
+
+    bool RestDownloadFile::isComplete() const
+    {
+        // Open ended segments are complete when the transfer completed,
+        // a truncated transfer is only detected when the upstream announced the length
+        if(mSize == 0)
+            return !mHasContentLength || (!mSegments.empty() && mSegments.front()->mReceived.load() == mContentLength);
+        return std::all_of(mSegments.begin(), mSegments.end(), [](const auto& segment) { return segment->isComplete(); });
+    }
+
+#ifdef _WIN32
+
+    bool RestDownloadFile::open(bool truncate, utility::ErrorState& errorState)
+    {
+        close();
+        auto path = std::filesystem::path(mPartPath).wstring();
+        HANDLE handle = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, truncate ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(!errorState.check(handle != INVALID_HANDLE_VALUE, "Unable to open %s for writing", mPartPath.c_str()))
+            return false;
+        mHandle = handle;
+        return true;
+    }
+
+
+    void RestDownloadFile::close()
+    {
+        if(mHandle == nullptr)
+            return;
+        CloseHandle(static_cast<HANDLE>(mHandle));
+        mHandle = nullptr;
+    }
+
+
+    bool RestDownloadFile::resize(uint64_t size)
+    {
+        LARGE_INTEGER position;
+        position.QuadPart = static_cast<LONGLONG>(size);
+        return SetFilePointerEx(static_cast<HANDLE>(mHandle), position, nullptr, FILE_BEGIN) && SetEndOfFile(static_cast<HANDLE>(mHandle));
+    }
+
+
+    bool RestDownloadFile::writeAt(uint64_t offset, const char* data, size_t size)
+    {
+        // Overlapped offsets make the write positional, segments never share a file pointer
+        while(size > 0)
+        {
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = static_cast<DWORD>(offset & 0xffffffffull);
+            overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD written = 0;
+            DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+            if(!WriteFile(static_cast<HANDLE>(mHandle), data, chunk, &written, &overlapped) || written == 0)
+                return false;
+            offset += written;
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+#else
+
+    bool RestDownloadFile::open(bool truncate, utility::ErrorState& errorState)
+    {
+        close();
+        int handle = ::open(mPartPath.c_str(), O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+        if(!errorState.check(handle >= 0, "Unable to open %s for writing", mPartPath.c_str()))
+            return false;
+        mHandle = handle;
+        return true;
+    }
+
+
+    void RestDownloadFile::close()
+    {
+        if(mHandle < 0)
+            return;
+        ::close(mHandle);
+        mHandle = -1;
+    }
+
+
+    bool RestDownloadFile::resize(uint64_t size)
+    {
+        return ::ftruncate(mHandle, static_cast<off_t>(size)) == 0;
+    }
+
+
+    bool RestDownloadFile::writeAt(uint64_t offset, const char* data, size_t size)
+    {
+        // Positional writes, segments never share a file pointer
+        while(size > 0)
+        {
+            auto written = ::pwrite(mHandle, data, size, static_cast<off_t>(offset));
+            if(written <= 0)
+                return false;
+            offset += static_cast<uint64_t>(written);
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+#endif
+}
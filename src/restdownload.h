@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <utility/errorstate.h>
+
+namespace nap
+{
+    /**
+     * Partially downloaded file, written with positional writes by the segments of a download.
+     * Data is written to '<path>.part', the progress of every segment to '<path>.part.state' so an interrupted download can be resumed.
+     * The partial file is moved to the final path once all segments are complete.
+     * Segments are written concurrently from multiple client worker threads, every segment by a single thread at a time.
+     */
+    class RestDownloadFile final
+    {
+    public:
+        /**
+         * A byte range of the file, fetched with a single Range request
+         */
+        struct Segment
+        {
+            uint64_t mStart = 0;                        ///< First byte of the segment
+            uint64_t mEnd = 0;                          ///< One past the last byte of the segment, 0 when the size is unknown
+            std::atomic<uint64_t> mReceived = { 0 };    ///< Bytes of the segment written to disk
+
+            /**
+             * @return if all bytes of the segment are written, always false when the size is unknown
+             */
+            bool isComplete() const { return mEnd > 0 && mStart + mReceived.load() >= mEnd; }
+        };
+
+        /**
+         * @param path the path of the downloaded file
+         */
+        RestDownloadFile(std::string path);
+
+        // Closes the partial file
+        ~RestDownloadFile();
+
+        /**
+         * Opens the partial file left behind by an earlier download of the same resource, only when its state can be trusted
+         * @param key identifies the resource, the url of the request including the query
+         * @param validator the ETag or Last-Modified of the resource, the partial file is discarded when it changed
+         * @param size the size of the resource in bytes
+         * @return true when the partial file was opened and can be resumed
+         */
+        bool resume(const std::string& key, const std::string& validator, uint64_t size);
+
+        /**
+         * Creates a new, empty partial file and splits it into segments, discards an earlier partial file
+         * @param key identifies the resource, the url of the request including the query
+         * @param validator the ETag or Last-Modified of the resource, empty when the download can't be resumed
+         * @param size the size of the resource in bytes, 0 when unknown, in which case a single open ended segment is created
+         * @param segmentCount the number of segments to split the file into
+         * @param errorState contains the error when the file can't be created
+         * @return true on success
+         */
+        bool create(const std::string& key, const std::string& validator, uint64_t size, int segmentCount, utility::ErrorState& errorState);
+
+        /**
+         * Writes data at the current position of a segment, advances the segment
+         * @param segment the segment to write to
+         * @param data the data to write
+         * @param size number of bytes to write
+         * @return false when the write fails or exceeds the segment
+         */
+        bool write(Segment& segment, const char* data, size_t size);
+
+        /**
+         * Stores the progress of the segments next to the partial file, only when the download can be resumed
+         */
+        void save();
+
+        /**
+         * Closes the partial file and moves it to the final path, removes the stored progress
+         * @param errorState contains the error when the file can't be moved
+         * @return true on success
+         */
+        bool commit(utility::ErrorState& errorState);
+
+        /**
+         * Closes the partial file, keeps the stored progress so the download can be resumed
+         */
+        void close();
+
+        /**
+         * Closes and removes the partial file and its stored progress
+         */
+        void discard();
+
+        /**
+         * Sets the number of bytes the upstream announced for a file of unknown size, the Content-Length of its response.
+         * The single open ended segment of the file is only complete when exactly this many bytes are written.
+         * @param length the number of bytes of the response body
+         */
+        void setContentLength(uint64_t length);
+
+        /**
+         * @return if all segments are complete, a file of unknown size is complete when all bytes of the announced Content-Length are written
+         */
+        bool isComplete() const;
+
+        /**
+         * @return the segments of the file
+         */
+        std::vector<std::unique_ptr<Segment>>& getSegments() { return mSegments; }
+
+        /**
+         * @return number of bytes written by an earlier download that were resumed
+         */
+        uint64_t getResumedBytes() const { return mResumedBytes; }
+
+        /**
+         * @return the size of the file, 0 when unknown
+         */
+        uint64_t getSize() const { return mSize; }
+
+        /**
+         * @return the path of the downloaded file
+         */
+        const std::string& getPath() const { return mPath; }
+
+    private:
+        bool open(bool truncate, utility::ErrorState& errorState);
+        bool resize(uint64_t size);
+        bool writeAt(uint64_t offset, const char* data, size_t size);
+
+        std::string mPath;
+        std::string mPartPath;
+        std::string mStatePath;
+        std::string mKey;
+        std::string mValidator;
+        uint64_t mSize = 0;
+        uint64_t mResumedBytes = 0;
+        uint64_t mContentLength = 0;
+        bool mHasContentLength = false;     ///< If the Content-Length of a file of unknown size is known
+        std::vector<std::unique_ptr<Segment>> mSegments;
+        std::mutex mStateMutex;             ///< Serializes writes of the stored progress
+
+#ifdef _WIN32
+        void* mHandle = nullptr;
+#else
+        int mHandle = -1;
+#endif
+    };
+}
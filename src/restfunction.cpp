@@ -11,6 +11,7 @@
 RTTI_BEGIN_CLASS_NO_DEFAULT_CONSTRUCTOR(nap::RestFunction)
     RTTI_PROPERTY("Address", &nap::RestFunction::mAddress, nap::rtti::EPropertyMetaData::Default)
         RTTI_PROPERTY("ValueDescriptions", &nap::RestFunction::mValueDescriptions, nap::rtti::EPropertyMetaData::Embedded)
+        RTTI_PROPERTY("StringViews", &nap::RestFunction::mStringViews, nap::rtti::EPropertyMetaData::Default)
 RTTI_END_CLASS
 
 RTTI_BEGIN_CLASS(nap::RestEchoFunction)
@@ -18,11 +19,41 @@ RTTI_END_CLASS
 
 namespace nap
 {
+    /**
+     * rapidjson output stream that appends to an existing string, keeping its capacity
+     */
+    struct StringOutputStream
+    {
+        typedef char Ch;
+        StringOutputStream(std::string& output) : mOutput(output) { }
+        void Put(char c) { mOutput.push_back(c); }
+        void Flush() { }
+        std::string& mOutput;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //// RestFunction
+    //////////////////////////////////////////////////////////////////////////
+
+    void RestFunction::respond(const RestValueMap& values, RestResponse& response)
+    {
+        // Take over the buffers allocated by call() instead of copying them, the pooled buffers are released
+        response = call(values);
+    }
+
     //////////////////////////////////////////////////////////////////////////
     //// RestEchoFunction
     //////////////////////////////////////////////////////////////////////////
 
     RestResponse RestEchoFunction::call(const RestValueMap& values)
+    {
+        RestResponse response;
+        respond(values, response);
+        return response;
+    }
+
+
+    void RestEchoFunction::respond(const RestValueMap& values, RestResponse& response)
     {
         // Construct JSON
         rapidjson::Document data(rapidjson::kObjectType);
@@ -49,6 +80,13 @@ namespace nap
                 continue;
             }
 
+            if(value->getRepresentedType() == RTTI_OF(std::string_view))
+            {
+                std::string_view val = static_cast<const APIStringView&>(*value.get()).mValue;
+                data.AddMember(rapidjson::StringRef(value->mName.c_str()), rapidjson::StringRef(val.data(), val.size()), data.GetAllocator());
+                continue;
+            }
+
             if(value->getRepresentedType() == RTTI_OF(bool))
             {
                 bool val = static_cast<const APIBool&>(*value.get()).mValue;
@@ -73,12 +111,11 @@ namespace nap
             nap::Logger::warn(*this, "Unsupported value type: %s, ignoring", value->getRepresentedType().get_name().to_string().c_str());
         }
 
-        // Serialize the response
-        rapidjson::StringBuffer buffer;
-        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+        // Serialize straight into the response buffer
+        StringOutputStream stream(response.getBuffer());
+        rapidjson::PrettyWriter<StringOutputStream> writer(stream);
         writer.SetMaxDecimalPlaces(4);
         data.Accept(writer);
-
-        return { buffer.GetString(), rest::contenttypes::json };
+        response.mContentType = rest::contenttypes::json;
     }
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <nap/resource.h>
 #include <nap/resourceptr.h>
 #include <apivalue.h>
+#include <string_view>
 
 #include "restresponse.h"
 #include "restvalue.h"
@@ -11,6 +12,13 @@ namespace nap
 {
     using RestValueMap = std::unordered_map<std::string, std::unique_ptr<APIBaseValue>>;
 
+    /**
+     * String values are handed to a RestFunction that enables StringViews as a view into the request, not as a copy.
+     * The view is only valid for the duration of RestFunction::call.
+     * Use RestFunction::extractValue<std::string> to obtain an owned copy.
+     */
+    using APIStringView = APIValue<std::string_view>;
+
     /**
      * Represents a rest call
      * The address is the path of the rest call
@@ -23,9 +31,11 @@ namespace nap
     public:
         std::string mAddress; ///< Property : 'Address' The address of the rest call
         std::vector<ResourcePtr<RestBaseValue>> mValueDescriptions; ///< Property : 'Values' The values of the rest call
+        bool mStringViews = false; ///< Property : 'StringViews' If string values are passed as APIStringView into the request instead of an APIString copy
     protected:
         /**
-         * Extracts a value from the values map
+         * Extracts a value from the values map.
+         * String values can be extracted as std::string (owned copy) or as std::string_view (only valid during call, no copy when StringViews is enabled).
          * @tparam T the value type
          * @param name name of the value
          * @param values reference to values map
@@ -39,10 +49,22 @@ namespace nap
         /**
          * The function to call when the rest call is made
          * Note: this function is called from a server worker thread
+         * Note: when StringViews is enabled, string values reference the request and are only valid until this function returns
          * @param values reference to values map
          * @return RestResponse the response to the call, will be sent back to the client
          */
         virtual RestResponse call(const RestValueMap& values) = 0;
+
+        /**
+         * Writes the response to the call into a response object that is pooled per server worker thread.
+         * The response is cleared but keeps its capacity, append to it to avoid allocating a new buffer for every call.
+         * The default implementation moves the result of call() into the response, it doesn't copy the body
+         * but also doesn't reuse the pooled buffer: only overrides of this function avoid allocating a buffer for every call.
+         * Note: this function is called from a server worker thread
+         * @param values reference to values map
+         * @param response the pooled response to write to, will be sent back to the client
+         */
+        virtual void respond(const RestValueMap& values, RestResponse& response);
     };
 
     //////////////////////////////////////////////////////////////////////////
@@ -73,6 +95,54 @@ namespace nap
         return true;
     }
 
+
+    template<>
+    inline bool RestFunction::extractValue<std::string_view>(const std::string& name,
+                                                             const RestValueMap& values,
+                                                             std::string_view& value,
+                                                             utility::ErrorState& errorState)
+    {
+        auto it = values.find(name);
+        if(it == values.end())
+        {
+            errorState.fail("Value not found: " + name);
+            return false;
+        }
+
+        auto view = rtti_cast<APIStringView>(it->second.get());
+        if(view != nullptr)
+        {
+            value = view->mValue;
+            return true;
+        }
+
+        auto str = rtti_cast<APIString>(it->second.get());
+        if(str != nullptr)
+        {
+            value = str->mValue;
+            return true;
+        }
+
+        errorState.fail("Value is not of the correct type: " + name);
+        return false;
+    }
+
+
+    template<>
+    inline bool RestFunction::extractValue<std::string>(const std::string& name,
+                                                        const RestValueMap& values,
+                                                        std::string& value,
+                                                        utility::ErrorState& errorState)
+    {
+        // Copy the viewed value, the caller asks for ownership
+        std::string_view view;
+        if(!extractValue<std::string_view>(name, values, view, errorState))
+            return false;
+
+        value.assign(view.data(), view.size());
+        return true;
+    }
+
     /**
      * A simple rest function that echoes the values it receives
      */
@@ -86,6 +156,13 @@ namespace nap
          * @return RestResponse the response to the call, will be sent back to the client
          */
         virtual RestResponse call(const RestValueMap& values) override;
+
+        /**
+         * Serializes the values directly into the pooled response
+         * @param values reference to values map
+         * @param response the pooled response to write to
+         */
+        virtual void respond(const RestValueMap& values, RestResponse& response) override;
     private:
     };
 }
\ No newline at end of file
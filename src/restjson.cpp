@@ -0,0 +1,620 @@
+#include "restjson.h"
+
+#include <rapidjson/error/en.h>
+#include <rapidjson/reader.h>
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <map>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace nap
+{
+    // Size of the memory blocks of a new arena, arenas grow to fit the documents parsed into them
+    static constexpr size_t sArenaSize = 64 * 1024;
+    static constexpr size_t sStackSize = 4 * 1024;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestJsonPool
+    ////////////////////////////////////////////////////////////////////////////
+
+    RestJsonPool::Arena::Arena(size_t size, size_t stackSize) :
+        mMemory(size), mStackMemory(stackSize),
+        mAllocator(mMemory.data(), mMemory.size()), mStackAllocator(mStackMemory.data(), mStackMemory.size()),
+        mDocument(&mAllocator, sStackSize / 2, &mStackAllocator)
+    {}
+
+
+    RestJsonPool::RestJsonPool(size_t maxArenas, size_t highWater) :
+        mMaxArenas(maxArenas), mHighWater(highWater)
+    {}
+
+
+    std::unique_ptr<RestJsonPool::Arena> RestJsonPool::acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(!mArenas.empty())
+            {
+                auto arena = std::move(mArenas.back());
+                mArenas.pop_back();
+                return arena;
+            }
+        }
+        return std::make_unique<Arena>(sArenaSize, sStackSize);
+    }
+
+
+    void RestJsonPool::release(std::unique_ptr<Arena> arena)
+    {
+        // A document that didn't fit spilled to the heap, the next document gets blocks that fit it
+        size_t capacity = arena->mAllocator.Capacity();
+        size_t stack_capacity = arena->mStackAllocator.Capacity();
+        if(capacity + stack_capacity > mHighWater)
+            return;
+
+        if(capacity > arena->mMemory.size() || stack_capacity > arena->mStackMemory.size())
+            arena = std::make_unique<Arena>(std::max(capacity, arena->mMemory.size()), std::max(stack_capacity, arena->mStackMemory.size()));
+        else
+        {
+            // The values of the document live in the memory that is cleared
+            arena->mDocument.SetNull();
+            arena->mAllocator.Clear();
+            arena->mStackAllocator.Clear();
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mArenas.size() < mMaxArenas)
+            mArenas.emplace_back(std::move(arena));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestJsonDocument
+    ////////////////////////////////////////////////////////////////////////////
+
+    RestJsonDocument::RestJsonDocument(std::shared_ptr<RestJsonPool> pool) :
+        mPool(std::move(pool))
+    {}
+
+
+    RestJsonDocument::~RestJsonDocument()
+    {
+        if(mArena != nullptr)
+            mPool->release(std::move(mArena));
+    }
+
+
+    bool RestJsonDocument::parse(RestResponse& response, utility::ErrorState& errorState)
+    {
+        if(mArena == nullptr)
+            mArena = mPool->acquire();
+
+        // Owned bodies are parsed in place, strings are not copied but terminated inside the body.
+        // Bodies shared with the cache can't be modified, only their strings are copied into the arena
+        auto& document = mArena->mDocument;
+        if(response.isShared())
+        {
+            const std::string& data = response.getData();
+            document.Parse(data.data(), data.size());
+        }
+        else
+        {
+            mData = response.takeData();
+            document.ParseInsitu(&mData[0]);
+        }
+        return errorState.check(!document.HasParseError(), "Invalid JSON at offset %llu : %s",
+                                static_cast<unsigned long long>(document.GetErrorOffset()), rapidjson::GetParseError_En(document.GetParseError()));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestJsonReader
+    ////////////////////////////////////////////////////////////////////////////
+
+    /**
+     * The properties of a type that can be read from JSON, by name
+     */
+    struct RestJsonReader::Table
+    {
+        enum class EKind : int
+        {
+            Basic,      ///< Arithmetic, enum or string value
+            Object,     ///< Compound value, read recursively
+            Array       ///< Array of values, read recursively
+        };
+
+        struct Field
+        {
+            Field(std::string name, const rtti::Property& property, const rtti::TypeInfo& type, EKind kind) :
+                mName(std::move(name)), mProperty(property), mType(type), mKind(kind) { }
+
+            std::string mName;
+            rtti::Property mProperty;
+            rtti::TypeInfo mType;
+            EKind mKind;
+        };
+
+        const Field* find(std::string_view name) const
+        {
+            auto it = mLookup.find(name);
+            return it != mLookup.end() ? it->second : nullptr;
+        }
+
+        std::vector<Field> mFields;
+        std::unordered_map<std::string_view, const Field*> mLookup;     ///< Views into the names of the fields
+    };
+
+    bool RestJsonReader::read(const rapidjson::Value& json, const rtti::Instance& object, utility::ErrorState& errorState)
+    {
+        std::string path;
+        return readObject(json, object, object.get_derived_type(), path, errorState);
+    }
+
+
+    const RestJsonReader::Table& RestJsonReader::getTable(const rtti::TypeInfo& type)
+    {
+        // Tables of all types read so far, built once per type
+        static std::shared_mutex sTableMutex;
+        static std::unordered_map<rtti::TypeInfo, std::unique_ptr<Table>> sTables;
+        {
+            std::shared_lock<std::shared_mutex> lock(sTableMutex);
+            auto it = sTables.find(type);
+            if(it != sTables.end())
+                return *it->second;
+        }
+
+        // Built outside of the lock, a type that is built twice concurrently keeps the first table
+        auto table = std::make_unique<Table>();
+        for(const rtti::Property& property : type.get_properties())
+        {
+            // Pointers refer to objects that are not part of the response
+            const rtti::TypeInfo property_type = property.get_type();
+            if(property_type.is_wrapper() || property_type.is_pointer())
+                continue;
+
+            Table::EKind kind;
+            if(property_type.is_array())
+                kind = Table::EKind::Array;
+            else if(property_type.is_arithmetic() || property_type.is_enumeration() || property_type == RTTI_OF(std::string))
+                kind = Table::EKind::Basic;
+            else if(property_type.is_class())
+                kind = Table::EKind::Object;
+            else
+                continue;
+            table->mFields.emplace_back(property.get_name().to_string(), property, property_type, kind);
+        }
+
+        for(const auto& field : table->mFields)
+            table->mLookup.emplace(field.mName, &field);
+
+        std::unique_lock<std::shared_mutex> lock(sTableMutex);
+        return *sTables.emplace(type, std::move(table)).first->second;
+    }
+
+
+    bool RestJsonReader::readObject(const rapidjson::Value& json, const rtti::Instance& object, const rtti::TypeInfo& type, std::string& path, utility::ErrorState& errorState)
+    {
+        if(!errorState.check(json.IsObject(), "Unable to read '%s' : expected an object", path.c_str()))
+            return false;
+
+        // The path is extended while descending and restored afterwards, it only ends up in the error message
+        const auto& table = getTable(type);
+        const size_t length = path.size();
+        for(auto member = json.MemberBegin(); member != json.MemberEnd(); ++member)
+        {
+            const auto* field = table.find(std::string_view(member->name.GetString(), member->name.GetStringLength()));
+            if(field == nullptr || member->value.IsNull())
+                continue;
+
+            path.append("/").append(field->mName);
+            switch(field->mKind)
+            {
+            case Table::EKind::Basic:
+                {
+                    rtti::Variant value = readBasic(member->value);
+                    if(!errorState.check(value.is_valid() && value.convert(field->mType) && field->mProperty.set_value(object, value),
+                        "Unable to read '%s' : expected %s", path.c_str(), field->mType.get_name().to_string().c_str()))
+                        return false;
+                    break;
+                }
+            case Table::EKind::Object:
+                {
+                    rtti::Variant value = field->mProperty.get_value(object);
+                    if(!readObject(member->value, rtti::Instance(value), field->mType, path, errorState))
+                        return false;
+                    field->mProperty.set_value(object, value);
+                    break;
+                }
+            case Table::EKind::Array:
+                {
+                    if(!errorState.check(member->value.IsArray(), "Unable to read '%s' : expected an array", path.c_str()))
+                        return false;
+
+                    rtti::Variant value = field->mProperty.get_value(object);
+                    rtti::VariantArray array = value.create_array_view();
+                    if(!readArray(member->value, array, path, errorState))
+                        return false;
+                    field->mProperty.set_value(object, value);
+                    break;
+                }
+            }
+            path.resize(length);
+        }
+        return true;
+    }
+
+
+    bool RestJsonReader::readArray(const rapidjson::Value& json, rtti::VariantArray& array, std::string& path, utility::ErrorState& errorState)
+    {
+        // Sized up front, elements are written in place
+        if(!errorState.check(array.set_size(json.Size()), "Unable to read '%s' : array can't hold %u elements", path.c_str(), json.Size()))
+            return false;
+
+        const rtti::TypeInfo element_type = array.get_rank_type(array.get_rank());
+        const size_t length = path.size();
+        for(rapidjson::SizeType index = 0; index < json.Size(); index++)
+        {
+            const auto& element = json[index];
+            path.append("/").append(std::to_string(index));
+            if(element.IsArray())
+            {
+                rtti::Variant value = array.get_value_as_ref(index);
+                rtti::VariantArray nested = value.create_array_view();
+                if(!readArray(element, nested, path, errorState))
+                    return false;
+            }
+            else if(element.IsObject())
+            {
+                rtti::Variant value = array.get_value_as_ref(index);
+                rtti::Variant wrapped = value.extract_wrapped_value();
+                if(!readObject(element, rtti::Instance(wrapped), element_type, path, errorState))
+                    return false;
+                array.set_value(index, wrapped);
+            }
+            else
+            {
+                rtti::Variant value = readBasic(element);
+                if(!errorState.check(value.is_valid() && value.convert(element_type) && array.set_value(index, value),
+                    "Unable to read '%s' : expected %s", path.c_str(), element_type.get_name().to_string().c_str()))
+                    return false;
+            }
+            path.resize(length);
+        }
+        return true;
+    }
+
+
+    rtti::Variant RestJsonReader::readBasic(const rapidjson::Value& json)
+    {
+        switch(json.GetType())
+        {
+        case rapidjson::kStringType:
+            return std::string(json.GetString(), json.GetStringLength());
+        case rapidjson::kFalseType:
+        case rapidjson::kTrueType:
+            return json.GetBool();
+        case rapidjson::kNumberType:
+            {
+                if(json.IsInt())
+                    return json.GetInt();
+                if(json.IsUint())
+                    return json.GetUint();
+                if(json.IsInt64())
+                    return json.GetInt64();
+                if(json.IsUint64())
+                    return json.GetUint64();
+                return json.GetDouble();
+            }
+        default:
+            return rtti::Variant();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestJsonExtractor
+    ////////////////////////////////////////////////////////////////////////////
+
+    // Consumed input the extractor keeps before it drops it from its buffer
+    static constexpr size_t sExtractorCompactSize = 64 * 1024;
+
+    /**
+     * The SAX handler, follows the parser through the tree of requested paths
+     */
+    struct RestJsonExtractor::Impl
+    {
+        // A step of a requested path, the paths form a tree that is walked while the document is parsed
+        struct Node
+        {
+            Node* find(std::string_view key)
+            {
+                auto it = mChildren.find(key);
+                return it != mChildren.end() ? it->second.get() : nullptr;
+            }
+
+            std::string mPointer;           ///< The requested path, when the node is a target
+            bool mTarget = false;
+            bool mResolved = false;
+            std::map<std::string, std::unique_ptr<Node>, std::less<>> mChildren;
+        };
+
+        // An open object or array, the node is null when the container is not on a requested path
+        struct Frame
+        {
+            Node* mNode = nullptr;
+            Node* mNext = nullptr;          ///< The node of the value after the last key of an object
+            bool mArray = false;
+            size_t mIndex = 0;              ///< The index of the next element of an array
+        };
+
+        // Reads the unparsed part of the buffer, the end of the buffer reads as the end of the document
+        struct Stream
+        {
+            typedef char Ch;
+            Stream(const std::string& buffer, size_t position, size_t offset) : mBuffer(buffer), mPosition(position), mOffset(offset) { }
+
+            Ch Peek() const { return mPosition < mBuffer.size() ? mBuffer[mPosition] : '\0'; }
+            Ch Take() { return mPosition < mBuffer.size() ? mBuffer[mPosition++] : '\0'; }
+            size_t Tell() const { return mOffset + mPosition; }
+
+            // Not parsed in place
+            Ch* PutBegin() { assert(false); return nullptr; }
+            void Put(Ch) { assert(false); }
+            void Flush() { assert(false); }
+            size_t PutEnd(Ch*) { assert(false); return 0; }
+
+            const std::string& mBuffer;
+            size_t mPosition;
+            size_t mOffset;
+        };
+
+        // Returns the node of the next value
+        Node* next()
+        {
+            if(mFrames.empty())
+                return &mRoot;
+
+            auto& frame = mFrames.back();
+            if(!frame.mArray)
+                return frame.mNext;
+
+            size_t index = frame.mIndex++;
+            if(frame.mNode == nullptr || frame.mNode->mChildren.empty())
+                return nullptr;
+            return frame.mNode->find(std::to_string(index));
+        }
+
+        // Marks a requested path as found, parsing stops once all paths are found
+        void resolve(Node& node)
+        {
+            node.mResolved = true;
+            mDone = --mRemaining == 0;
+        }
+
+        template<typename T>
+        bool value(const T& value)
+        {
+            Node* node = next();
+            if(node != nullptr && node->mTarget && !node->mResolved)
+            {
+                mValues.emplace(node->mPointer, std::make_unique<APIValue<T>>(node->mPointer, value));
+                resolve(*node);
+            }
+            return true;
+        }
+
+        bool container(bool array)
+        {
+            Node* node = next();
+            if(node != nullptr && node->mTarget && !node->mResolved)
+                resolve(*node);
+            Frame frame;
+            frame.mNode = node;
+            frame.mArray = array;
+            mFrames.emplace_back(frame);
+            return true;
+        }
+
+        // SAX events
+        bool Null()                                             { Node* node = next(); if(node != nullptr && node->mTarget && !node->mResolved) resolve(*node); return true; }
+        bool Bool(bool b)                                       { return value(b); }
+        bool Int(int i)                                         { return value(i); }
+        bool Uint(unsigned u)                                   { return u <= static_cast<unsigned>(INT_MAX) ? value(static_cast<int>(u)) : value(static_cast<int64_t>(u)); }
+        bool Int64(int64_t i)                                   { return value(i); }
+        bool Uint64(uint64_t u)                                 { return u <= static_cast<uint64_t>(INT64_MAX) ? value(static_cast<int64_t>(u)) : value(static_cast<double>(u)); }
+        bool Double(double d)                                   { return value(d); }
+        bool RawNumber(const char* str, rapidjson::SizeType length, bool)  { return value(std::string(str, length)); }
+        bool String(const char* str, rapidjson::SizeType length, bool)     { return value(std::string(str, length)); }
+        bool StartObject()                                      { return container(false); }
+        bool EndObject(rapidjson::SizeType)                     { mFrames.pop_back(); return true; }
+        bool StartArray()                                       { return container(true); }
+        bool EndArray(rapidjson::SizeType)                      { mFrames.pop_back(); return true; }
+
+        bool Key(const char* str, rapidjson::SizeType length, bool)
+        {
+            auto& frame = mFrames.back();
+            frame.mNext = frame.mNode != nullptr ? frame.mNode->find(std::string_view(str, length)) : nullptr;
+            return true;
+        }
+
+        // Returns the position of the first token at or after the given position, the end of the buffer when there is none
+        size_t skipWhitespace(size_t position) const
+        {
+            while(position < mBuffer.size() && (mBuffer[position] == ' ' || mBuffer[position] == '\t' || mBuffer[position] == '\n' || mBuffer[position] == '\r'))
+                position++;
+            return position;
+        }
+
+        // Returns true when the token at the given position is complete, the parser can't continue a token it only got part of
+        // A delimiter is followed by a value in the same parse step, that value must be complete as well
+        bool hasToken(size_t position, bool last) const
+        {
+            position = skipWhitespace(position);
+            if(position >= mBuffer.size())
+                return false;
+
+            char c = mBuffer[position];
+            switch(c)
+            {
+            case '"':
+                for(size_t i = position + 1; i < mBuffer.size(); i++)
+                {
+                    if(mBuffer[i] == '\\')
+                        i++;
+                    else if(mBuffer[i] == '"')
+                        return true;
+                }
+                return false;
+            case ',':
+            case ':':
+                return hasToken(position + 1, last);
+            case '{':
+            case '}':
+            case '[':
+            case ']':
+                return true;
+            default:
+                {
+                    // Numbers and literals end at the first character that can't be part of them
+                    for(size_t i = position; i < mBuffer.size(); i++)
+                    {
+                        if(std::strchr("+-.0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ", mBuffer[i]) == nullptr)
+                            return true;
+                    }
+                    return last;
+                }
+            }
+        }
+
+        // Parses all complete tokens in the buffer, all remaining tokens when this is the last chunk
+        void parse(bool last)
+        {
+            Stream stream(mBuffer, mPosition, mOffset);
+            while(!mDone && !mFailed && !mReader.IterativeParseComplete() && hasToken(stream.mPosition, last))
+            {
+                if(!mReader.IterativeParseNext<rapidjson::kParseDefaultFlags>(stream, *this))
+                {
+                    mFailed = true;
+                    mErrorState.fail("Invalid JSON at offset %llu : %s", static_cast<unsigned long long>(mReader.GetErrorOffset()), rapidjson::GetParseError_En(mReader.GetParseErrorCode()));
+                }
+            }
+
+            // Drop the parsed input, the parser doesn't refer to it
+            mPosition = stream.mPosition;
+            if(mPosition >= sExtractorCompactSize && mPosition * 2 >= mBuffer.size())
+            {
+                mBuffer.erase(0, mPosition);
+                mOffset += mPosition;
+                mPosition = 0;
+            }
+        }
+
+        Node mRoot;
+        size_t mRemaining = 0;
+        bool mDone = false;
+        bool mFailed = false;
+        utility::ErrorState mErrorState;
+        RestValueMap mValues;
+        std::vector<Frame> mFrames;
+        rapidjson::Reader mReader;
+        std::string mBuffer;                ///< Received input that is not parsed yet
+        size_t mPosition = 0;               ///< Parse position in the buffer
+        size_t mOffset = 0;                 ///< Offset of the buffer in the document
+    };
+
+
+    RestJsonExtractor::RestJsonExtractor() :
+        mImpl(std::make_unique<Impl>())
+    {}
+
+
+    RestJsonExtractor::~RestJsonExtractor()
+    {}
+
+
+    bool RestJsonExtractor::init(const std::vector<std::string>& pointers, utility::ErrorState& errorState)
+    {
+        // Every path is split into its reference tokens, ~1 and ~0 decode to / and ~
+        for(const auto& pointer : pointers)
+        {
+            if(!errorState.check(pointer.empty() || pointer.front() == '/', "Invalid JSON Pointer '%s' : must be empty or start with '/'", pointer.c_str()))
+                return false;
+
+            Impl::Node* node = &mImpl->mRoot;
+            size_t position = 0;
+            while(position < pointer.size())
+            {
+                size_t end = pointer.find('/', position + 1);
+                if(end == std::string::npos)
+                    end = pointer.size();
+
+                std::string token;
+                for(size_t i = position + 1; i < end; i++)
+                {
+                    if(pointer[i] != '~')
+                    {
+                        token += pointer[i];
+                        continue;
+                    }
+                    char escaped = i + 1 < end ? pointer[++i] : '\0';
+                    if(!errorState.check(escaped == '0' || escaped == '1', "Invalid JSON Pointer '%s' : '~' must be followed by 0 or 1", pointer.c_str()))
+                        return false;
+                    token += escaped == '0' ? '~' : '/';
+                }
+
+                auto& child = node->mChildren[token];
+                if(child == nullptr)
+                    child = std::make_unique<Impl::Node>();
+                node = child.get();
+                position = end;
+            }
+
+            if(node->mTarget)
+                continue;
+            node->mTarget = true;
+            node->mPointer = pointer;
+            mImpl->mRemaining++;
+        }
+
+        mImpl->mDone = mImpl->mRemaining == 0;
+        mImpl->mReader.IterativeParseInit();
+        return true;
+    }
+
+
+    bool RestJsonExtractor::write(const char* data, size_t size)
+    {
+        if(mImpl->mDone || mImpl->mFailed)
+            return false;
+
+        mImpl->mBuffer.append(data, size);
+        mImpl->parse(false);
+        return !mImpl->mDone && !mImpl->mFailed;
+    }
+
+
+    bool RestJsonExtractor::finish(utility::ErrorState& errorState)
+    {
+        if(!mImpl->mDone && !mImpl->mFailed)
+        {
+            mImpl->parse(true);
+            if(!mImpl->mDone && !mImpl->mFailed && !mImpl->mReader.IterativeParseComplete())
+            {
+                mImpl->mFailed = true;
+                mImpl->mErrorState.fail("Invalid JSON at offset %llu : document is incomplete", static_cast<unsigned long long>(mImpl->mOffset + mImpl->mBuffer.size()));
+            }
+        }
+
+        if(!mImpl->mFailed)
+            return true;
+        errorState.fail("%s", mImpl->mErrorState.toString().c_str());
+        return false;
+    }
+
+
+    const RestValueMap& RestJsonExtractor::getValues() const
+    {
+        return mImpl->mValues;
+    }
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <rapidjson/document.h>
+#include <rtti/typeinfo.h>
+#include <utility/errorstate.h>
+
+#include "restfunction.h"
+#include "restresponse.h"
+
+namespace nap
+{
+    /**
+     * JSON document of which both the values and the parse stack are allocated from pooled memory.
+     * The root of the document is a regular rapidjson::Value.
+     */
+    using RestPooledDocument = rapidjson::GenericDocument<rapidjson::UTF8<>, rapidjson::MemoryPoolAllocator<>, rapidjson::MemoryPoolAllocator<>>;
+
+
+    /**
+     * Memory that JSON documents are parsed into, shared by the documents of a client.
+     * The memory of a released document is cleared and handed to the next document, together with the document itself,
+     * so parsing a response doesn't allocate once the pool is warm.
+     * Documents are parsed on client worker threads and released on the thread that completes the request.
+     */
+    class RestJsonPool final
+    {
+        friend class RestJsonDocument;
+    public:
+        /**
+         * @param maxArenas maximum number of released arenas kept for reuse
+         * @param highWater arenas that grew beyond this number of bytes are released instead of reused
+         */
+        RestJsonPool(size_t maxArenas = 8, size_t highWater = 4 * 1024 * 1024);
+
+    private:
+        // Blocks of memory for the values and the parse stack and the document that uses them,
+        // the allocators fall back to the heap when a block is full
+        struct Arena
+        {
+            Arena(size_t size, size_t stackSize);
+            std::vector<char> mMemory;
+            std::vector<char> mStackMemory;
+            rapidjson::MemoryPoolAllocator<> mAllocator;
+            rapidjson::MemoryPoolAllocator<> mStackAllocator;
+            RestPooledDocument mDocument;
+        };
+
+        std::unique_ptr<Arena> acquire();
+        void release(std::unique_ptr<Arena> arena);
+
+        std::mutex mMutex;
+        std::vector<std::unique_ptr<Arena>> mArenas;
+        size_t mMaxArenas;
+        size_t mHighWater;
+    };
+
+
+    /**
+     * A JSON document parsed from a response body, into a document and memory taken from a pool.
+     * Owned bodies are moved into the document and parsed in place, its strings point into the body.
+     * Bodies shared with the cache are not modified, their strings are copied into the pooled memory instead.
+     * The document and its memory are returned to the pool when this object is destroyed.
+     */
+    class RestJsonDocument final
+    {
+    public:
+        /**
+         * @param pool the pool to take memory from
+         */
+        RestJsonDocument(std::shared_ptr<RestJsonPool> pool);
+
+        // Returns the memory to the pool
+        ~RestJsonDocument();
+
+        RestJsonDocument(const RestJsonDocument&) = delete;
+        RestJsonDocument& operator=(const RestJsonDocument&) = delete;
+
+        /**
+         * Parses the body of a response. An owned body is moved into the document and modified while parsing,
+         * a body shared with the cache is left untouched.
+         * @param response the response to parse the body of
+         * @param errorState contains the parse error and its offset
+         * @return true when the body is valid JSON
+         */
+        bool parse(RestResponse& response, utility::ErrorState& errorState);
+
+        /**
+         * @return the root of the parsed document, only valid after a successful parse
+         */
+        const rapidjson::Value& getDocument() const { return mArena->mDocument; }
+
+    private:
+        std::shared_ptr<RestJsonPool> mPool;
+        std::unique_ptr<RestJsonPool::Arena> mArena;
+        std::string mData;
+    };
+
+
+    /**
+     * Reads JSON into RTTI objects, JSON members are matched to the properties of the object by name.
+     * Basic values are converted to the type of the property, objects and arrays are read into compound and array properties.
+     * The property table of a type is built the first time the type is read and cached for all later reads.
+     * Members without a matching property are skipped, pointer properties are never written. Safe to use from multiple threads.
+     */
+    class RestJsonReader final
+    {
+    public:
+        /**
+         * Reads a JSON object into an RTTI object
+         * @param json the JSON object to read
+         * @param object the object to write the properties of
+         * @param errorState contains the path of the member that could not be read
+         * @return true on success
+         */
+        static bool read(const rapidjson::Value& json, const rtti::Instance& object, utility::ErrorState& errorState);
+
+    private:
+        struct Table;
+        static const Table& getTable(const rtti::TypeInfo& type);
+        static bool readObject(const rapidjson::Value& json, const rtti::Instance& object, const rtti::TypeInfo& type, std::string& path, utility::ErrorState& errorState);
+        static bool readArray(const rapidjson::Value& json, rtti::VariantArray& array, std::string& path, utility::ErrorState& errorState);
+        static rtti::Variant readBasic(const rapidjson::Value& json);
+    };
+
+
+    /**
+     * Extracts the values at a set of JSON Pointer paths from a JSON document that arrives in chunks, without building the document.
+     * The chunks are run through a SAX parser as they arrive, values at the requested paths are stored as typed values keyed by their path:
+     * booleans, integers that fit an int, 64 bit integers, doubles and strings. Paths that refer to an object, array or null resolve without a value.
+     * Parsing stops as soon as all paths are resolved, the rest of the document is never read.
+     */
+    class RestJsonExtractor final
+    {
+    public:
+        // Default constructor
+        RestJsonExtractor();
+
+        // Default destructor
+        ~RestJsonExtractor();
+
+        /**
+         * @param pointers the JSON Pointer paths (RFC 6901) to extract, such as "/data/0/name"
+         * @param errorState contains the first invalid path
+         * @return true when all paths are valid
+         */
+        bool init(const std::vector<std::string>& pointers, utility::ErrorState& errorState);
+
+        /**
+         * Parses the next chunk of the document
+         * @param data the chunk
+         * @param size size of the chunk in bytes
+         * @return false when no more data is needed, because all paths are resolved or the document is invalid
+         */
+        bool write(const char* data, size_t size);
+
+        /**
+         * Parses the remainder of the document once all chunks are written
+         * @param errorState contains the parse error and its offset
+         * @return true when all paths are resolved or the document is valid and complete
+         */
+        bool finish(utility::ErrorState& errorState);
+
+        /**
+         * @return the extracted values, keyed by their path, paths that were not found are missing
+         */
+        const RestValueMap& getValues() const;
+
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> mImpl;
+    };
+}
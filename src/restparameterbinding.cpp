@@ -0,0 +1,306 @@
+#include "restparameterbinding.h"
+
+#include <nap/logger.h>
+#include <algorithm>
+#include <sstream>
+
+namespace nap
+{
+    ////////////////////////////////////////////////////////////////////////////
+    //// Utility functions forwarded declarations
+    ////////////////////////////////////////////////////////////////////////////
+
+    template<typename T>
+    static T extractValue(const std::string& value_str);
+
+    template<typename T>
+    static std::unique_ptr<APIBaseValue> createValue(const std::string& name, std::string_view value_str);
+
+    template<>
+    std::unique_ptr<APIBaseValue> createValue<std::string>(const std::string& name, std::string_view value_str);
+
+    template<>
+    std::unique_ptr<APIBaseValue> createValue<std::string_view>(const std::string& name, std::string_view value_str);
+
+    static bool requiresDecoding(std::string_view encoded);
+
+    static bool decodeURL(std::string_view encoded, char* output, size_t capacity, size_t& length);
+
+    static const std::unordered_map<rtti::TypeInfo, RestParameterBinding::ValueCreator> sValueCreators =
+    {
+        {RTTI_OF(int),          createValue<int>},
+        {RTTI_OF(float),        createValue<float>},
+        {RTTI_OF(std::string),  createValue<std::string>},
+        {RTTI_OF(bool),         createValue<bool>},
+        {RTTI_OF(double),       createValue<double>},
+        {RTTI_OF(long),         createValue<long>}
+    };
+
+    // Maximum number of seeds to try for a given table size before growing the table
+    static constexpr int sMaxSeedAttempts = 256;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestParameterBinding
+    ////////////////////////////////////////////////////////////////////////////
+
+    bool RestParameterBinding::init(const RestFunction& function, utility::ErrorState& errorState)
+    {
+        mFunction = const_cast<RestFunction*>(&function);
+        mSlots.clear();
+        mMaxNameLength = 0;
+
+        const auto& descriptions = function.mValueDescriptions;
+        mRequiredMask.assign(std::max<size_t>((descriptions.size() + 63) / 64, 1), 0);
+
+        // Create a slot for every declared value
+        for(const auto& description : descriptions)
+        {
+            // A name that is declared more than once binds to its first declaration and is required when any declaration is
+            auto existing = std::find_if(mSlots.begin(), mSlots.end(), [&description](const auto& slot) { return slot.mDescription->mName == description->mName; });
+            if(existing != mSlots.end())
+            {
+                if(description->mRequired)
+                    mRequiredMask[existing->mWord] |= existing->mBit;
+                continue;
+            }
+
+            Slot slot;
+            slot.mDescription = description.get();
+            slot.mWord = mSlots.size() / 64;
+            slot.mBit = uint64_t(1) << (mSlots.size() % 64);
+
+            // String values are only handed out as a view into the request when the function asks for it
+            auto it = sValueCreators.find(description->getRepresentedType());
+            if(it != sValueCreators.end())
+                slot.mCreator = function.mStringViews && description->getRepresentedType() == RTTI_OF(std::string) ? createValue<std::string_view> : it->second;
+            else
+                nap::Logger::warn("%s: unsupported value type: %s, ignoring", function.mID.c_str(), description->getRepresentedType().get_name().to_string().c_str());
+
+            if(description->mRequired)
+                mRequiredMask[slot.mWord] |= slot.mBit;
+
+            mMaxNameLength = std::max(mMaxNameLength, description->mName.size());
+
+            mSlots.emplace_back(slot);
+        }
+
+        // Find a seed that maps all names to a unique position in the table, grow the table when no seed is found
+        size_t table_size = 1;
+        while(table_size < mSlots.size() * 2)
+            table_size <<= 1;
+
+        while(true)
+        {
+            mTableMask = table_size - 1;
+            for(int attempt = 0; attempt < sMaxSeedAttempts; attempt++)
+            {
+                mSeed = static_cast<uint64_t>(attempt) * 0x9E3779B97F4A7C15ull;
+                mTable.assign(table_size, -1);
+
+                bool collision = false;
+                for(size_t i = 0; i < mSlots.size() && !collision; i++)
+                {
+                    auto& entry = mTable[hash(mSlots[i].mDescription->mName, mSeed) & mTableMask];
+                    collision = entry >= 0;
+                    entry = static_cast<int>(i);
+                }
+
+                if(!collision)
+                    return true;
+            }
+            table_size <<= 1;
+        }
+    }
+
+
+    const RestParameterBinding::Slot* RestParameterBinding::find(std::string_view name) const
+    {
+        if(mSlots.empty())
+            return nullptr;
+
+        int index = mTable[hash(name, mSeed) & mTableMask];
+        if(index < 0)
+            return nullptr;
+
+        const Slot& slot = mSlots[index];
+        return slot.mDescription->mName == name ? &slot : nullptr;
+    }
+
+
+    const RestBaseValue* RestParameterBinding::bind(std::string_view target, RestValueMap& values, std::string& decodeBuffer) const
+    {
+        // Skip the path and fragment
+        auto query_start = target.find('?');
+        if(query_start != std::string_view::npos)
+            target.remove_prefix(query_start + 1);
+        auto fragment_start = target.find('#');
+        if(fragment_start != std::string_view::npos)
+            target = target.substr(0, fragment_start);
+        const size_t query_size = target.size();
+        decodeBuffer.clear();
+
+        // Decoded keys are compared on the stack, keys that decode to something longer than any declared name are skipped
+        char key_buffer[256];
+        const size_t key_capacity = std::min(sizeof(key_buffer), mMaxNameLength);
+
+        Mask found(mRequiredMask.size());
+        while(!target.empty())
+        {
+            // Split off the next key-value pair
+            auto pair_end = target.find('&');
+            std::string_view pair = target.substr(0, pair_end);
+            target.remove_prefix(pair_end == std::string_view::npos ? target.size() : pair_end + 1);
+
+            auto separator = pair.find('=');
+            std::string_view key = pair.substr(0, separator);
+            std::string_view value = separator == std::string_view::npos ? std::string_view() : pair.substr(separator + 1);
+            if(key.empty())
+                continue;
+
+            // Find the slot, decode the key only when required
+            const Slot* slot = nullptr;
+            if(requiresDecoding(key))
+            {
+                size_t key_length = 0;
+                if(decodeURL(key, key_buffer, key_capacity, key_length))
+                    slot = find(std::string_view(key_buffer, key_length));
+            }
+            else
+            {
+                slot = find(key);
+            }
+
+            if(slot == nullptr || found.test(*slot))
+                continue;
+
+            found.set(*slot);
+            if(slot->mCreator == nullptr)
+                continue;
+
+            // Decode the value into the buffer when required, otherwise reference the target
+            if(requiresDecoding(value))
+            {
+                // Decoded values are never longer than the encoded query, reserve once so views remain valid
+                if(decodeBuffer.capacity() < query_size)
+                    decodeBuffer.reserve(query_size);
+
+                size_t offset = decodeBuffer.size();
+                size_t length = 0;
+                decodeBuffer.resize(offset + value.size());
+                decodeURL(value, decodeBuffer.data() + offset, value.size(), length);
+                decodeBuffer.resize(offset + length);
+                value = std::string_view(decodeBuffer.data() + offset, length);
+            }
+            values.emplace(slot->mDescription->mName, slot->mCreator(slot->mDescription->mName, value));
+        }
+        return findMissing(found);
+    }
+
+
+    uint64_t RestParameterBinding::hash(std::string_view name, uint64_t seed)
+    {
+        // FNV-1a, seeded
+        uint64_t hash = 0xcbf29ce484222325ull ^ seed;
+        for(char c : name)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 0x100000001b3ull;
+        }
+        return hash ^ (hash >> 32);
+    }
+
+
+    const RestBaseValue* RestParameterBinding::findMissing(const Mask& found) const
+    {
+        for(size_t word = 0; word < mRequiredMask.size(); word++)
+        {
+            uint64_t missing = mRequiredMask[word] & ~found.word(word);
+            if(missing == 0)
+                continue;
+
+            // Report the first missing value in order of declaration
+            for(size_t i = word * 64; i < std::min(mSlots.size(), (word + 1) * 64); i++)
+            {
+                if((missing & mSlots[i].mBit) != 0)
+                    return mSlots[i].mDescription;
+            }
+        }
+        return nullptr;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// Utility functions
+    ////////////////////////////////////////////////////////////////////////////
+
+    template<typename T>
+    static T extractValue(const std::string& value_str)
+    {
+        T value;
+        std::istringstream(value_str) >> value;
+        return value;
+    }
+
+
+    template<typename T>
+    static std::unique_ptr<APIBaseValue> createValue(const std::string& name, std::string_view value_str)
+    {
+        T value = extractValue<T>(std::string(value_str));
+        return std::make_unique<APIValue<T>>(name, value);
+    }
+
+
+    template<>
+    std::unique_ptr<APIBaseValue> createValue<std::string>(const std::string& name, std::string_view value_str)
+    {
+        // Single copy of the complete value
+        return std::make_unique<APIString>(name, std::string(value_str));
+    }
+
+
+    template<>
+    std::unique_ptr<APIBaseValue> createValue<std::string_view>(const std::string& name, std::string_view value_str)
+    {
+        // View into the request, valid for the duration of the handler
+        return std::make_unique<APIStringView>(name, value_str);
+    }
+
+
+    static bool requiresDecoding(std::string_view encoded)
+    {
+        return encoded.find_first_of("%+") != std::string_view::npos;
+    }
+
+
+    static int fromHex(char c)
+    {
+        if(c >= '0' && c <= '9') return c - '0';
+        if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+
+    static bool decodeURL(std::string_view encoded, char* output, size_t capacity, size_t& length)
+    {
+        // Decodes '+' to space and %XX escapes, malformed escapes are copied as is
+        length = 0;
+        for(size_t i = 0; i < encoded.size(); i++)
+        {
+            if(length == capacity)
+                return false;
+
+            char c = encoded[i];
+            if(c == '+')
+            {
+                c = ' ';
+            }
+            else if(c == '%' && i + 2 < encoded.size() && fromHex(encoded[i + 1]) >= 0 && fromHex(encoded[i + 2]) >= 0)
+            {
+                c = static_cast<char>((fromHex(encoded[i + 1]) << 4) | fromHex(encoded[i + 2]));
+                i += 2;
+            }
+            output[length++] = c;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <apivalue.h>
+#include <string_view>
+
+#include "restfunction.h"
+
+namespace nap
+{
+    /**
+     * Binds the query parameters of a request to the values declared by a RestFunction.
+     * The declared value names are compiled into a perfect hash when the server starts,
+     * every query key maps straight to its slot and typed value creator without intermediate lookups.
+     * Missing required values are detected with a bitmask, a single word for up to 64 declared values.
+     */
+    class RestParameterBinding final
+    {
+    public:
+        // Creates a typed value from a parameter name and its (decoded) string representation
+        using ValueCreator = std::unique_ptr<APIBaseValue>(*)(const std::string&, std::string_view);
+
+        /**
+         * A slot in the binding, one for every declared value
+         */
+        struct Slot
+        {
+            const RestBaseValue* mDescription = nullptr;    ///< The value description
+            ValueCreator mCreator = nullptr;                ///< The typed value creator, nullptr when the type is not supported
+            size_t mWord = 0;                               ///< The word of this slot in the found / required masks
+            uint64_t mBit = 0;                              ///< The bit of this slot in its word
+        };
+
+        /**
+         * The slots found in a request, a single word on the stack for up to 64 declared values,
+         * functions that declare more values allocate the additional words.
+         */
+        class Mask final
+        {
+        public:
+            explicit Mask(size_t words) { if(words > 1) mWords.assign(words - 1, 0); }
+            bool test(const Slot& slot) const  { return (word(slot.mWord) & slot.mBit) != 0; }
+            void set(const Slot& slot)         { (slot.mWord == 0 ? mFirst : mWords[slot.mWord - 1]) |= slot.mBit; }
+            uint64_t word(size_t index) const  { return index == 0 ? mFirst : mWords[index - 1]; }
+        private:
+            uint64_t mFirst = 0;
+            std::vector<uint64_t> mWords;
+        };
+
+        /**
+         * Compiles the perfect hash for the values declared by the given function
+         * @param function the function to create the binding for
+         * @param errorState contains the error state
+         * @return true on success
+         */
+        bool init(const RestFunction& function, utility::ErrorState& errorState);
+
+        /**
+         * Finds the slot that corresponds to the given parameter name
+         * @param name the name of the parameter
+         * @return the slot, nullptr if the name is not declared by the function
+         */
+        const Slot* find(std::string_view name) const;
+
+        /**
+         * Extracts all declared values from the given request parameters, scanning the parameters once.
+         * When a parameter is specified multiple times the first occurrence is used.
+         * @tparam Params multimap of parameter name to decoded value
+         * @param params the request parameters
+         * @param values the map to add the extracted values to
+         * @return nullptr on success, otherwise the description of the first missing required value
+         */
+        template<typename Params>
+        const RestBaseValue* bind(const Params& params, RestValueMap& values) const;
+
+        /**
+         * Extracts all declared values from a raw, url encoded, request target or query string.
+         * Only declared parameters are decoded, unknown keys are skipped without allocating.
+         * Values that don't require decoding reference the target directly,
+         * decoded values are stored in the given buffer. Both must outlive the extracted values.
+         * When a parameter is specified multiple times the first occurrence is used.
+         * @param target the raw request target, everything up to and including the first '?' is skipped
+         * @param values the map to add the extracted values to
+         * @param decodeBuffer storage for decoded values
+         * @return nullptr on success, otherwise the description of the first missing required value
+         */
+        const RestBaseValue* bind(std::string_view target, RestValueMap& values, std::string& decodeBuffer) const;
+
+        /**
+         * @return the function this binding was created for
+         */
+        RestFunction& getFunction() const { return *mFunction; }
+
+    private:
+        // Hashes a name using the given seed
+        static uint64_t hash(std::string_view name, uint64_t seed);
+
+        // Returns the first missing required value, nullptr if all required values are found
+        const RestBaseValue* findMissing(const Mask& found) const;
+
+        RestFunction* mFunction = nullptr;
+        std::vector<Slot> mSlots;                   ///< All slots, in order of declaration
+        std::vector<int> mTable;                    ///< Perfect hash table, slot index or -1 when empty
+        uint64_t mSeed = 0;                         ///< The seed that produces a collision free table
+        uint64_t mTableMask = 0;                    ///< Table size - 1, the table size is a power of 2
+        std::vector<uint64_t> mRequiredMask;        ///< Bits of all required slots, one word for every 64 slots
+        size_t mMaxNameLength = 0;                  ///< Length of the longest declared name
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //// RestParameterBinding Template Definitions
+    //////////////////////////////////////////////////////////////////////////
+
+    template<typename Params>
+    const RestBaseValue* RestParameterBinding::bind(const Params& params, RestValueMap& values) const
+    {
+        Mask found(mRequiredMask.size());
+        for(const auto& [key, value] : params)
+        {
+            const Slot* slot = find(key);
+            if(slot == nullptr || found.test(*slot))
+                continue;
+
+            found.set(*slot);
+            if(slot->mCreator != nullptr)
+                values.emplace(slot->mDescription->mName, slot->mCreator(slot->mDescription->mName, value));
+        }
+        return findMissing(found);
+    }
+}
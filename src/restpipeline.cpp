@@ -0,0 +1,231 @@
+#include "restpipeline.h"
+
+#include <algorithm>
+
+namespace nap
+{
+    // Minimum read deadline of the first pipelined batch
+    static constexpr std::chrono::milliseconds sMinProbeTimeOut(250);
+
+    // The read deadline of the first pipelined batch, in round trips of the request that confirmed keep-alive
+    static constexpr int sProbeRoundTrips = 4;
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestPipeline
+    ////////////////////////////////////////////////////////////////////////////
+
+    RestPipeline::RestPipeline(std::string host, int port, int timeOutSeconds) :
+        mHost(std::move(host)), mPort(port),
+        mSocket(timeOutSeconds > 0 ? timeOutSeconds : CPPHTTPLIB_CONNECTION_TIMEOUT_SECOND,
+                timeOutSeconds > 0 ? timeOutSeconds : CPPHTTPLIB_CLIENT_READ_TIMEOUT_SECOND,
+                timeOutSeconds > 0 ? timeOutSeconds : CPPHTTPLIB_CLIENT_WRITE_TIMEOUT_SECOND)
+    {}
+
+
+    RestPipeline::~RestPipeline()
+    {
+        close();
+    }
+
+
+    bool RestPipeline::send(std::vector<Exchange*>& exchanges, const httplib::Headers& headers, std::string& error)
+    {
+        if(exchanges.empty())
+            return true;
+
+        if(!connect(error))
+            return false;
+
+        // Expose the exchanges to abort while they are being sent
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mInFlight = &exchanges;
+            mAnswered = 0;
+            mAborted = false;
+        }
+
+        // A new connection sends a single request first, the others are only pipelined when its response confirms keep-alive
+        size_t first = 0;
+        bool sent = true;
+        if(!mConfirmed)
+        {
+            auto start = std::chrono::steady_clock::now();
+            sent = transfer(exchanges, 0, 1, headers, error);
+            mConfirmed = sent && mSupported;
+            first = 1;
+
+            // The first pipelined batch is expected to answer within a few round trips of the confirming request
+            if(mConfirmed && !mProven)
+            {
+                auto round_trip = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+                mProbeTimeOut = std::min<std::chrono::microseconds>(mSocket.getReadTimeOut(), std::max<std::chrono::microseconds>(sMinProbeTimeOut, round_trip * sProbeRoundTrips));
+            }
+        }
+
+        if(mConfirmed && first < exchanges.size())
+        {
+            // Upstreams that keep the connection open but drop pipelined requests never answer, don't wait for the full read timeout
+            bool probing = !mProven && exchanges.size() - first > 1;
+            if(probing)
+                mSocket.setReadTimeOut(mProbeTimeOut);
+            sent = transfer(exchanges, first, exchanges.size(), headers, error);
+            if(probing)
+            {
+                mSocket.resetReadTimeOut();
+                mProven = sent && mSupported;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mInFlight = nullptr;
+        }
+        return sent && std::all_of(exchanges.begin(), exchanges.end(), [](const auto* exchange) { return exchange->mReceived; });
+    }
+
+
+    void RestPipeline::abort()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mInFlight == nullptr || mAnswered.load() >= mInFlight->size())
+            return;
+
+        // The other exchanges on the connection still need their response
+        for(size_t i = mAnswered.load(); i < mInFlight->size(); i++)
+        {
+            const auto& abandoned = (*mInFlight)[i]->mAbandoned;
+            if(abandoned == nullptr || !abandoned())
+                return;
+        }
+
+        // Unblocks the worker that is writing or reading, the connection is closed by the worker
+        mAborted = true;
+        mSocket.shutdown();
+    }
+
+
+    bool RestPipeline::transfer(std::vector<Exchange*>& exchanges, size_t first, size_t last, const httplib::Headers& headers, std::string& error)
+    {
+        // Write all requests in one go
+        std::string host_header = mPort == 80 ? mHost : mHost + ":" + std::to_string(mPort);
+        std::string data;
+        for(size_t i = first; i < last; i++)
+        {
+            data += "GET ";
+            data += exchanges[i]->mTarget;
+            data += " HTTP/1.1\r\nHost: ";
+            data += host_header;
+            data += "\r\nAccept: */*\r\nConnection: keep-alive\r\n";
+            for(const auto& [key, value] : headers)
+            {
+                data += key;
+                data += ": ";
+                data += value;
+                data += "\r\n";
+            }
+            data += "\r\n";
+        }
+
+        if(!mSocket.write(data))
+        {
+            error = mAborted ? "Pipelined requests cancelled" : "Failed to write pipelined requests";
+            close();
+            return false;
+        }
+
+        // Read the responses in order, stop when the upstream closes or fails
+        bool pipelined = last - first > 1;
+        for(size_t i = first; i < last; i++)
+        {
+            auto& exchange = *exchanges[i];
+            bool delimited = true;
+            if(!mSocket.read(exchange.mResponse, exchange.mProgress, delimited))
+            {
+                // Aborted, or the upstream dropped requests that were in the pipeline
+                if(mAborted)
+                {
+                    error = "Pipelined requests cancelled";
+                }
+                else if(pipelined)
+                {
+                    error = mProven ? "Upstream did not answer all pipelined requests" : "Upstream did not answer the first pipelined requests in time";
+                    mSupported = false;
+                }
+                else
+                {
+                    error = "Upstream did not answer the request";
+                }
+                close();
+                return false;
+            }
+            exchange.mReceived = true;
+            mAnswered++;
+
+            // Responses that close the connection, downgrade to HTTP/1.0 or end when the connection closes end the pipeline
+            bool closing = exchange.mResponse.version == "HTTP/1.0" || exchange.mResponse.get_header_value("Connection") == "close" || !delimited;
+            if(closing)
+            {
+                mSupported = false;
+                close();
+                if(i + 1 < exchanges.size())
+                {
+                    error = "Upstream closed the pipelined connection";
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+
+    bool RestPipeline::parseURL(const std::string& url, std::string& host, int& port)
+    {
+        std::string host_port = url;
+        const std::string scheme = "http://";
+        if(host_port.compare(0, scheme.size(), scheme) == 0)
+            host_port = host_port.substr(scheme.size());
+        else if(host_port.find("://") != std::string::npos)
+            return false;
+
+        // Strip the path
+        host_port = host_port.substr(0, host_port.find('/'));
+
+        // Split host and port, ipv6 addresses are enclosed in brackets
+        auto bracket = host_port.find(']');
+        auto colon = host_port.rfind(':');
+        if(colon != std::string::npos && (bracket == std::string::npos || colon > bracket))
+        {
+            host = host_port.substr(0, colon);
+            port = std::atoi(host_port.c_str() + colon + 1);
+        }
+        else
+        {
+            host = host_port;
+            port = 80;
+        }
+
+        if(!host.empty() && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+
+        return !host.empty() && port > 0;
+    }
+
+
+    bool RestPipeline::connect(std::string& error)
+    {
+        // Reuse the connection when the upstream kept it open
+        if(mSocket.isAlive())
+            return true;
+
+        close();
+        return mSocket.connect(mHost, mPort, error);
+    }
+
+
+    void RestPipeline::close()
+    {
+        // Every new connection confirms keep-alive again
+        mSocket.close();
+        mConfirmed = false;
+    }
+}
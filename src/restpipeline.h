@@ -0,0 +1,107 @@
+#pragma once
+
+#include "httplibwrapper.h"
+#include "restsocket.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace nap
+{
+    /**
+     * Sends multiple GET requests back to back over a single plain HTTP/1.1 connection and matches the responses in order.
+     * httplib waits for every response before the next request goes out, the pipeline saves a round trip per request.
+     * Every new connection first sends a single request, requests are only pipelined after its response confirms HTTP/1.1 keep-alive.
+     * The first pipelined batch must be answered within a short deadline, upstreams that keep the connection open
+     * but drop pipelined requests are detected without waiting for the full read timeout.
+     * The pipeline then reports itself as unsupported and requests should be sent through the regular client.
+     * Not thread safe, the pipeline is owned and used by a single connection, only abort can be called from other threads.
+     */
+    class RestPipeline final
+    {
+    public:
+        /**
+         * A request and its response
+         */
+        struct Exchange
+        {
+            std::string mTarget;                ///< Path including the encoded query
+            httplib::Response mResponse;        ///< The response, only valid when received
+            bool mReceived = false;             ///< If the response was received
+            httplib::Progress mProgress;        ///< Optional, receives the progress of the response body, must return true
+            std::function<bool()> mAbandoned;   ///< Optional, returns true when the response is no longer needed, called from any thread
+        };
+
+        /**
+         * @param host the host to connect to
+         * @param port the port to connect to
+         * @param timeOutSeconds connection, read and write timeout, 0 uses the httplib defaults
+         */
+        RestPipeline(std::string host, int port, int timeOutSeconds);
+
+        // Closes the connection
+        ~RestPipeline();
+
+        /**
+         * Writes all requests back to back and reads the responses in order.
+         * The first request on a new connection is sent on its own, the others follow once its response confirms keep-alive.
+         * Exchanges that are not received, because the upstream closed the connection or failed, can be resent through the regular client.
+         * @param exchanges the requests to send
+         * @param headers the headers to send with every request
+         * @param error the error when not all responses are received
+         * @return true if all responses are received
+         */
+        bool send(std::vector<Exchange*>& exchanges, const httplib::Headers& headers, std::string& error);
+
+        /**
+         * @return false once the upstream is found not to support pipelining
+         */
+        bool isSupported() const { return mSupported; }
+
+        /**
+         * Aborts the exchanges that are being sent when none of the exchanges that are not received yet is needed anymore.
+         * Aborted exchanges are not received, the pipeline remains supported. Safe to call from any thread.
+         */
+        void abort();
+
+        /**
+         * @return if the connection is open, it might have been closed by the upstream since
+         */
+        bool isOpen() const { return mSocket.isOpen(); }
+
+        // Closes the connection
+        void close();
+
+        /**
+         * Parses a client URL into host and port, only plain http URLs can be pipelined
+         * @param url the url, with or without http:// scheme
+         * @param host the parsed host
+         * @param port the parsed port
+         * @return false if the URL can't be pipelined
+         */
+        static bool parseURL(const std::string& url, std::string& host, int& port);
+
+    private:
+        // Opens the connection when not open
+        bool connect(std::string& error);
+
+        // Writes the requests and reads the responses
+        bool transfer(std::vector<Exchange*>& exchanges, size_t first, size_t last, const httplib::Headers& headers, std::string& error);
+
+        std::string mHost;
+        int mPort;
+        bool mSupported = true;
+        bool mConfirmed = false;                                    ///< If the upstream confirmed HTTP/1.1 keep-alive on the current connection
+        bool mProven = false;                                       ///< If the upstream answered a pipelined batch, no deadline applies anymore
+        std::chrono::microseconds mProbeTimeOut = {};               ///< Read deadline of the first pipelined batch
+
+        RestSocket mSocket;
+
+        // Abort is called from other threads
+        std::mutex mMutex;                                          ///< Guards the exchanges in flight
+        std::vector<Exchange*>* mInFlight = nullptr;                ///< The exchanges that are being sent
+        std::atomic<size_t> mAnswered = { 0 };                      ///< Number of exchanges in flight that are received
+        std::atomic_bool mAborted = { false };
+    };
+}
@@ -0,0 +1,45 @@
+#include "restresponse.h"
+
+#include <cassert>
+
+namespace nap
+{
+    std::string& RestResponse::getBuffer()
+    {
+        // Detach from the cache, the shared body is never modified
+        if(mSharedData != nullptr)
+        {
+            mData.assign(*mSharedData);
+            mSharedData.reset();
+        }
+        return mData;
+    }
+
+
+    void RestResponse::setData(std::string data)
+    {
+        mData = std::move(data);
+        mSharedData.reset();
+    }
+
+
+    void RestResponse::setData(std::shared_ptr<const std::string> data)
+    {
+        assert(data != nullptr);
+        mSharedData = std::move(data);
+        mData.clear();
+    }
+
+
+    std::string RestResponse::takeData()
+    {
+        // Bodies shared with the cache are copied, only owned bodies can be moved out
+        if(mSharedData != nullptr)
+        {
+            std::string data = *mSharedData;
+            mSharedData.reset();
+            return data;
+        }
+        return std::move(mData);
+    }
+}
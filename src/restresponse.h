@@ -1,11 +1,13 @@
 #pragma once
 
 #include <nap/core.h>
+#include <memory>
 
 namespace nap
 {
     /**
      * Represents a response from a REST call.
+     * The body is either owned by the response or shared with the cache of a client, read it with getData().
      */
     struct NAPAPI RestResponse
     {
@@ -14,10 +16,47 @@ namespace nap
          * @param data the data
          * @param contentType the content type
          */
-        RestResponse(std::string data, std::string contentType) : mData(std::move(data)), mContentType(std::move(contentType)) { }
+        RestResponse(std::string data, std::string contentType) : mContentType(std::move(contentType)), mData(std::move(data)) { }
         RestResponse() = default;
 
-        std::string mData = "";
+        /**
+         * @return the body, either owned by the response or shared with the cache of the client
+         */
+        const std::string& getData() const { return mSharedData != nullptr ? *mSharedData : mData; }
+
+        /**
+         * @return if the body is shared with the cache of the client, a shared body is never modified
+         */
+        bool isShared() const { return mSharedData != nullptr; }
+
+        /**
+         * Returns the owned body as mutable buffer, a body shared with the cache is copied into the buffer first.
+         * @return the owned body
+         */
+        std::string& getBuffer();
+
+        /**
+         * Replaces the body
+         * @param data the new body, owned by the response
+         */
+        void setData(std::string data);
+
+        /**
+         * Shares the body with the cache of a client instead of copying it
+         * @param data the shared body, can't be nullptr
+         */
+        void setData(std::shared_ptr<const std::string> data);
+
+        /**
+         * Moves the body out of the response, a body shared with the cache is copied
+         * @return the body
+         */
+        std::string takeData();
+
         std::string mContentType = "";
+
+    private:
+        std::string mData = "";                         ///< The owned body, unused when the body is shared
+        std::shared_ptr<const std::string> mSharedData; ///< The body shared with the cache of the client, nullptr when the body is owned
     };
-}
\ No newline at end of file
+}
@@ -1,6 +1,7 @@
 #include "restserver.h"
 #include "httplibwrapper.h"
 #include "restutils.h"
+#include "restparameterbinding.h"
 
 #include <nap/logger.h>
 
@@ -11,29 +12,17 @@ RTTI_BEGIN_CLASS_NO_DEFAULT_CONSTRUCTOR(nap::RestServer)
     RTTI_PROPERTY("Host", &nap::RestServer::mHost, nap::rtti::EPropertyMetaData::Default)
     RTTI_PROPERTY("Verbose", &nap::RestServer::mVerbose, nap::rtti::EPropertyMetaData::Default)
     RTTI_PROPERTY("MaxConcurrentRequests", &nap::RestServer::mMaxConcurrentRequests, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("LazyQueryParsing", &nap::RestServer::mLazyQueryParsing, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("ResponseBufferHighWater", &nap::RestServer::mResponseBufferHighWater, nap::rtti::EPropertyMetaData::Default)
 RTTI_END_CLASS
 
 namespace nap
 {
-    ////////////////////////////////////////////////////////////////////////////
-    //// Utility functions forwarded declarations
-    ////////////////////////////////////////////////////////////////////////////
-
-    template<typename T>
-    T extractValue(const std::string& value_str);
-
-    template<typename T>
-    static std::unique_ptr<APIBaseValue> createValue(const std::string& name, const std::string& value_str);
+    // Response pooled per server worker thread, buffers keep their capacity across requests
+    static thread_local RestResponse sPooledResponse;
 
-    static std::unordered_map<rtti::TypeInfo, std::function<std::unique_ptr<APIBaseValue>(const std::string&, const std::string&)>> sValueCreators =
-    {
-        {RTTI_OF(int),          createValue<int>},
-        {RTTI_OF(float),        createValue<float>},
-        {RTTI_OF(std::string),  createValue<std::string>},
-        {RTTI_OF(bool),         createValue<bool>},
-        {RTTI_OF(double),       createValue<double>},
-        {RTTI_OF(long),         createValue<long>}
-    };
+    // Buffer to decode lazily parsed parameters into, pooled per server worker thread
+    static thread_local std::string sDecodeBuffer;
 
     ////////////////////////////////////////////////////////////////////////////
     //// RestServer::Impl
@@ -42,6 +31,7 @@ namespace nap
     struct RestServer::Impl
     {
         httplib::Server mServer;
+        std::vector<std::unique_ptr<RestParameterBinding>> mBindings;
     };
 
     ////////////////////////////////////////////////////////////////////////////
@@ -64,6 +54,27 @@ namespace nap
         if (maxConcurrentRequest > 0)
             mImpl->mServer.new_task_queue = [maxConcurrentRequest] { return new httplib::ThreadPool(maxConcurrentRequest); };
 
+        // Lazy parsing only pays off when httplib skips its own parse of the query string,
+        // which requires the patched httplib header, see patches/httplib_query_parsing.cmake
+#ifdef NAPREST_HTTPLIB_QUERY_PARSING
+        mImpl->mServer.set_query_parsing(!mLazyQueryParsing);
+#else
+        if(mLazyQueryParsing)
+        {
+            nap::Logger::warn("%s: LazyQueryParsing requires the patched httplib header, parsing all query parameters instead", mID.c_str());
+            mLazyQueryParsing = false;
+        }
+#endif
+
+        // Compile the parameter binding of every function
+        for(const auto& function : mRestFunctions)
+        {
+            auto binding = std::make_unique<RestParameterBinding>();
+            if(!binding->init(*function, errorState))
+                return false;
+            mImpl->mBindings.emplace_back(std::move(binding));
+        }
+
         return true;
     }
 
@@ -73,13 +84,7 @@ namespace nap
         if(!mRunning.load())
         {
             mRunning.store(true);
-            std::vector<RestFunction*> calls;
-            for(auto c : mRestFunctions)
-            {
-                calls.emplace_back(c.get());
-            }
-
-            mThread = std::thread(&RestServer::run, this, calls, mHost, mPort, mVerbose);
+            mThread = std::thread(&RestServer::run, this, mHost, mPort, mVerbose);
         }
 
         return true;
@@ -103,8 +108,7 @@ namespace nap
     }
 
 
-    void RestServer::run(const std::vector<RestFunction*>& functions,
-                         const std::string& host, int port, bool verbose)
+    void RestServer::run(const std::string& host, int port, bool verbose)
     {
         if(verbose)
         {
@@ -117,81 +121,60 @@ namespace nap
         mImpl->mServer.set_error_handler([](const httplib::Request& req, httplib::Response& res)
                                          {
                                              const auto response = utility::generateErrorResponse("Not Found");
-                                             res.set_content(response.mData, rest::contenttypes::json);
+                                             res.set_content(response.getData(), rest::contenttypes::json);
                                          });
 
 
-        for(auto& function : functions)
+        for(const auto& binding_ptr : mImpl->mBindings)
         {
             // Add function callback to server
-            mImpl->mServer.Get(function->mAddress, [this, &function](const httplib::Request& req, httplib::Response& res)
+            const RestParameterBinding* binding = binding_ptr.get();
+            bool lazy = mLazyQueryParsing;
+            size_t high_water = static_cast<size_t>(std::max(mResponseBufferHighWater, 0));
+            mImpl->mServer.Get(binding->getFunction().mAddress, [binding, lazy, high_water](const httplib::Request& req, httplib::Response& res)
             {
                 // Create map of values
-                std::unordered_map<std::string, std::unique_ptr<APIBaseValue>> values;
+                RestValueMap values;
 
-                // Create the response object
-                RestResponse response = { "", rest::contenttypes::text};
+                // Reuse the response object of this worker thread
+                RestResponse* response = &sPooledResponse;
+                response->getBuffer().clear();
+                response->mContentType.clear();
 
-                // Check if all required values are present
-                bool valid_params = true;
+                // Extract values from request in a single pass over the parameters,
+                // when lazy the values are extracted from the raw request target and req.params is ignored
+                const RestBaseValue* missing = lazy ?
+                    binding->bind(req.target, values, sDecodeBuffer) :
+                    binding->bind(req.params, values);
 
-                // Extract values from request and add to map
-                for(auto& val_description : function->mValueDescriptions)
+                // Call the function, get the response data
+                // If a required value is missing, return a bad request
+                if(missing == nullptr)
+                    binding->getFunction().respond(values, *response);
+                else
                 {
-                    // Check if the value is present
-                    if(req.has_param(val_description->mName))
-                    {
-                        // Try to extract the value
-                        auto val_str = req.get_param_value(val_description->mName);
-                        if(sValueCreators.find(val_description->getRepresentedType()) == sValueCreators.end())
-                        {
-                            nap::Logger::warn(*this, utility::stringFormat("Unsupported value type: %s, ignoring", val_description->getRepresentedType().get_name().to_string().c_str()));
-                            continue;
-                        }
-
-                        // Create the value and add it to the map
-                        values.emplace(val_description->mName, sValueCreators[val_description->getRepresentedType()](val_description->mName, val_str));
-                    }else
-                    {
-                        // If the value is required, return a bad request
-                        if(val_description->mRequired)
-                        {
-                            response = utility::generateErrorResponse(utility::stringFormat("Error : Missing required parameter %s", val_description->mName.c_str()));
-                            valid_params = false;
-                            break;
-                        }
-                    }
+                    const auto error = utility::generateErrorResponse(utility::stringFormat("Error : Missing required parameter %s", missing->mName.c_str()));
+                    response->getBuffer().assign(error.getData());
+                    response->mContentType.assign(error.mContentType);
                 }
 
-                // Call the function, get the response data
-                if(valid_params)
-                    response = function->call(values);
-
-                // Serve the response
-                res.set_content(response.mData, response.mContentType);
+                // Serve the response straight from the pooled buffer, without copying it into the http response.
+                // The body is written by this worker thread after the handler returns, before it handles another request.
+                res.set_content_provider(response->getData().size(), response->mContentType,
+                                         [response](size_t offset, size_t length, httplib::DataSink& sink)
+                                         {
+                                             return sink.write(response->getData().data() + offset, length);
+                                         },
+                                         [response, high_water](bool success)
+                                         {
+                                             // Release buffers that grew beyond the high-water mark, don't let a single large response pin memory
+                                             std::string& buffer = response->getBuffer();
+                                             if(buffer.capacity() > high_water)
+                                                 std::string().swap(buffer);
+                                         });
             });
         }
 
         mImpl->mServer.listen(host, port);
     }
-
-    ////////////////////////////////////////////////////////////////////////////
-    //// Utility functions
-    ////////////////////////////////////////////////////////////////////////////
-
-    template<typename T>
-    T extractValue(const std::string& value_str)
-    {
-        T value;
-        std::istringstream(value_str) >> value;
-        return value;
-    }
-
-
-    template<typename T>
-    static std::unique_ptr<APIBaseValue> createValue(const std::string& name, const std::string& value_str)
-    {
-        T value = extractValue<T>(value_str);
-        return std::make_unique<APIValue<T>>(name, value);
-    }
 }
\ No newline at end of file
@@ -63,10 +63,12 @@ namespace nap
         std::string mHost = "localhost"; ///< Property : 'Host' The host on which the server listens
         bool mVerbose = true; ///< Property : 'Verbose' If the server should be verbose
         int mMaxConcurrentRequests = 0; ///< Property : 'MaxConcurrentRequests' The maximum number of concurrent requests, 0 means unlimited
+        bool mLazyQueryParsing = false; ///< Property : 'LazyQueryParsing' If only the parameters declared by a function are decoded from the request target, httplib then skips parsing the query string. Requires the patched httplib header
+        int mResponseBufferHighWater = 1024 * 1024; ///< Property : 'ResponseBufferHighWater' Pooled response buffers with a capacity above this number of bytes are released after the response is sent
     private:
         // The main server loop
         std::atomic_bool mRunning = {false};
-        void run(const std::vector<RestFunction*>& functions, const std::string& host, int port, bool verbose);
+        void run(const std::string& host, int port, bool verbose);
         std::thread mThread;
 
         // RestService
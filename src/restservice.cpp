@@ -6,16 +6,36 @@
 #include <nap/resourcemanager.h>
 #include <nap/logger.h>
 #include <iostream>
+#include <chrono>
 
 #include "restserver.h"
 #include "restclient.h"
 
+RTTI_BEGIN_ENUM(nap::ERestDispatchFairness)
+    RTTI_ENUM_VALUE(nap::ERestDispatchFairness::RoundRobin, "RoundRobin"),
+    RTTI_ENUM_VALUE(nap::ERestDispatchFairness::Sequential, "Sequential")
+RTTI_END_ENUM
+
+RTTI_BEGIN_CLASS(nap::RestServiceConfiguration)
+    RTTI_PROPERTY("FrameBudget", &nap::RestServiceConfiguration::mFrameBudget, nap::rtti::EPropertyMetaData::Default)
+    RTTI_PROPERTY("Fairness", &nap::RestServiceConfiguration::mFairness, nap::rtti::EPropertyMetaData::Default)
+RTTI_END_CLASS
+
 RTTI_BEGIN_CLASS_NO_DEFAULT_CONSTRUCTOR(nap::RestService)
 	RTTI_CONSTRUCTOR(nap::ServiceConfiguration*)
 RTTI_END_CLASS
 
 namespace nap
 {
+    //////////////////////////////////////////////////////////////////////////
+    //// RestServiceConfiguration
+    //////////////////////////////////////////////////////////////////////////
+
+    rtti::TypeInfo RestServiceConfiguration::getServiceType() const
+    {
+        return RTTI_OF(RestService);
+    }
+
     //////////////////////////////////////////////////////////////////////////
     //// RestService
     //////////////////////////////////////////////////////////////////////////
@@ -33,6 +53,58 @@ namespace nap
         {
             client->update(deltaTime);
         }
+
+        mDeferredCount = 0;
+        if(mClients.empty())
+            return;
+
+        // Compute the deadline for completing requests, no deadline when there is no budget
+        auto* config = getConfiguration<RestServiceConfiguration>();
+        float budget = config != nullptr ? config->mFrameBudget : 0.0f;
+        ERestDispatchFairness fairness = config != nullptr ? config->mFairness : ERestDispatchFairness::RoundRobin;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float, std::milli>(budget));
+        auto expired = [budget, deadline]() { return budget > 0.0f && std::chrono::steady_clock::now() >= deadline; };
+
+        // Rotate the first client every frame, so no client is always served last
+        mFirstClient = (mFirstClient + 1) % mClients.size();
+        bool budget_left = true;
+        switch(fairness)
+        {
+        case ERestDispatchFairness::RoundRobin:
+            {
+                // Complete one request per client in turn, until all are done or the budget is spent
+                bool completed = true;
+                while(completed && budget_left)
+                {
+                    completed = false;
+                    for(size_t i = 0; i < mClients.size() && budget_left; i++)
+                    {
+                        completed |= mClients[(mFirstClient + i) % mClients.size()]->complete();
+                        budget_left = !expired();
+                    }
+                }
+                break;
+            }
+        case ERestDispatchFairness::Sequential:
+            {
+                // Complete all requests of a client before moving on to the next one
+                for(size_t i = 0; i < mClients.size() && budget_left; i++)
+                {
+                    auto* client = mClients[(mFirstClient + i) % mClients.size()];
+                    while(budget_left && client->complete())
+                        budget_left = !expired();
+                }
+                break;
+            }
+        }
+
+        // Record the requests that are carried over to the next frame
+        if(!budget_left)
+        {
+            for(auto client : mClients)
+                mDeferredCount += static_cast<int>(client->getPendingCount());
+            mTotalDeferredCount += mDeferredCount;
+        }
     }
 
 
@@ -7,6 +7,32 @@ namespace nap
 {
     // forward declarations
     class RestClient;
+    class RestService;
+
+    /**
+     * How completed requests of multiple clients share the per frame time budget
+     */
+    enum class ERestDispatchFairness : int
+    {
+        RoundRobin  = 0,    ///< Complete one request of every client in turn
+        Sequential  = 1     ///< Complete all requests of a client before moving to the next, the first client rotates every frame
+    };
+
+    /**
+     * RestService configuration
+     */
+    class NAPAPI RestServiceConfiguration : public ServiceConfiguration
+    {
+        RTTI_ENABLE(ServiceConfiguration)
+    public:
+        float mFrameBudget = 0.0f;                                          ///< Property: 'FrameBudget' Max time in milliseconds spent on request callbacks and progress reports every frame, 0 means unlimited
+        ERestDispatchFairness mFairness = ERestDispatchFairness::RoundRobin; ///< Property: 'Fairness' How clients share the frame budget
+
+        /**
+         * @return RestService type
+         */
+        rtti::TypeInfo getServiceType() const override;
+    };
 
 	class NAPAPI RestService : public Service
 	{
@@ -23,12 +49,30 @@ namespace nap
          */
         void registerObjectCreators(rtti::Factory &factory) override;
 
+        /**
+         * Completes the requests handled by all clients, within the frame budget
+         * Requests that don't fit in the budget are carried over to the next frame
+         * @param deltaTime time in seconds since last update
+         */
         void update(double deltaTime) override;
+
+        /**
+         * @return number of completed requests and progress reports carried over to the next frame during the last update
+         */
+        int getDeferredCount() const { return mDeferredCount; }
+
+        /**
+         * @return total number of times a completed request or progress report was carried over to the next frame
+         */
+        uint64_t getTotalDeferredCount() const { return mTotalDeferredCount; }
     private:
         void registerRestClient(RestClient& client);
 
         void removeRestClient(RestClient& client);
 
         std::vector<RestClient*> mClients;
+        size_t mFirstClient = 0;            ///< Client that is served first, rotates every frame
+        int mDeferredCount = 0;
+        uint64_t mTotalDeferredCount = 0;
 	};
 }
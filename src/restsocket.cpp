@@ -0,0 +1,221 @@
+#include "restsocket.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace nap
+{
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestSocket::Stream
+    ////////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Buffered socket stream read by the httplib parsers, the read timeout can be changed between reads
+     */
+    class RestSocket::Stream final : public httplib::Stream
+    {
+    public:
+        Stream(socket_t socket, std::chrono::microseconds readTimeOut, time_t writeTimeOut) :
+            mSocket(socket), mReadTimeOut(readTimeOut), mWriteTimeOut(writeTimeOut), mBuffer(sBufferSize)
+        {}
+
+        bool is_readable() const override
+        {
+            auto seconds = std::chrono::duration_cast<std::chrono::seconds>(mReadTimeOut);
+            return httplib::detail::select_read(mSocket, seconds.count(), (mReadTimeOut - seconds).count()) > 0;
+        }
+
+        bool is_writable() const override
+        {
+            return httplib::detail::select_write(mSocket, mWriteTimeOut, 0) > 0 && httplib::detail::is_socket_alive(mSocket);
+        }
+
+        ssize_t read(char* ptr, size_t size) override
+        {
+            // Hand out buffered data first, fill the buffer when it's empty
+            if(mOffset == mSize)
+            {
+                if(!is_readable())
+                    return -1;
+
+                auto received = httplib::detail::read_socket(mSocket, mBuffer.data(), mBuffer.size(), CPPHTTPLIB_RECV_FLAGS);
+                if(received <= 0)
+                    return received;
+                mOffset = 0;
+                mSize = static_cast<size_t>(received);
+            }
+
+            size = std::min(size, mSize - mOffset);
+            std::memcpy(ptr, mBuffer.data() + mOffset, size);
+            mOffset += size;
+            return static_cast<ssize_t>(size);
+        }
+
+        ssize_t write(const char* ptr, size_t size) override
+        {
+            if(!is_writable())
+                return -1;
+            return httplib::detail::send_socket(mSocket, ptr, size, CPPHTTPLIB_SEND_FLAGS);
+        }
+
+        void get_remote_ip_and_port(std::string& ip, int& port) const override
+        {
+            httplib::detail::get_remote_ip_and_port(mSocket, ip, port);
+        }
+
+        void get_local_ip_and_port(std::string& ip, int& port) const override
+        {
+            httplib::detail::get_local_ip_and_port(mSocket, ip, port);
+        }
+
+        socket_t socket() const override { return mSocket; }
+
+        void setReadTimeOut(std::chrono::microseconds timeOut) { mReadTimeOut = timeOut; }
+
+    private:
+        static constexpr size_t sBufferSize = 16 * 1024;
+
+        socket_t mSocket;
+        std::chrono::microseconds mReadTimeOut;
+        time_t mWriteTimeOut;
+        std::vector<char> mBuffer;
+        size_t mOffset = 0;
+        size_t mSize = 0;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////
+    //// RestSocket
+    ////////////////////////////////////////////////////////////////////////////
+
+    RestSocket::RestSocket(time_t connectionTimeOut, time_t readTimeOut, time_t writeTimeOut) :
+        mConnectionTimeOut(connectionTimeOut), mReadTimeOut(readTimeOut), mWriteTimeOut(writeTimeOut)
+    {}
+
+
+    RestSocket::~RestSocket()
+    {
+        close();
+    }
+
+
+    bool RestSocket::connect(const std::string& host, int port, std::string& error)
+    {
+        close();
+
+        httplib::Error result = httplib::Error::Success;
+        socket_t socket = httplib::detail::create_client_socket(host, "", port, AF_UNSPEC, true, false, nullptr,
+                                                                mConnectionTimeOut, 0, mReadTimeOut, 0, mWriteTimeOut, 0, "", result);
+        if(socket == INVALID_SOCKET)
+        {
+            error = "Failed to connect : " + httplib::to_string(result);
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mSocket = socket;
+        mStream = std::make_unique<Stream>(mSocket, std::chrono::seconds(mReadTimeOut), mWriteTimeOut);
+        return true;
+    }
+
+
+    bool RestSocket::isAlive() const
+    {
+        return mStream != nullptr && httplib::detail::is_socket_alive(mSocket);
+    }
+
+
+    bool RestSocket::write(const std::string& data)
+    {
+        return mStream != nullptr && httplib::detail::write_data(*mStream, data.data(), data.size());
+    }
+
+
+    bool RestSocket::read(httplib::Response& response, const httplib::Progress& progress, bool& delimited)
+    {
+        if(mStream == nullptr)
+            return false;
+
+        // Interim responses, such as 100 Continue, precede the final response to the same request
+        while(true)
+        {
+            // Status line
+            char buffer[2048];
+            httplib::detail::stream_line_reader line_reader(*mStream, buffer, sizeof(buffer));
+            if(!line_reader.getline())
+                return false;
+
+            std::string line(line_reader.ptr(), line_reader.size());
+            if(line.size() < 12 || line.compare(0, 7, "HTTP/1.") != 0)
+                return false;
+
+            response.version = line.substr(0, 8);
+            response.status = std::atoi(line.c_str() + 9);
+            response.reason.clear();
+            auto reason_start = line.find(' ', 9);
+            auto reason_end = line.find_last_not_of("\r\n");
+            if(reason_start != std::string::npos && reason_end != std::string::npos && reason_end > reason_start)
+                response.reason = line.substr(reason_start + 1, reason_end - reason_start);
+
+            // Headers
+            response.headers.clear();
+            if(!httplib::detail::read_headers(*mStream, response.headers))
+                return false;
+
+            // The connection no longer speaks HTTP after switching protocols
+            if(response.status == httplib::StatusCode::SwitchingProtocol_101)
+                return false;
+
+            if(response.status >= 200)
+                break;
+        }
+
+        // A body without length or chunked encoding ends when the connection closes
+        delimited = response.has_header("Content-Length") || httplib::detail::is_chunked_transfer_encoding(response.headers);
+        bool has_body = response.status != httplib::StatusCode::NoContent_204 && response.status != httplib::StatusCode::NotModified_304;
+        if(!has_body)
+            return true;
+
+        int status = response.status;
+        auto receiver = [&response](const char* data, size_t size, uint64_t, uint64_t)
+        {
+            response.body.append(data, size);
+            return true;
+        };
+        return httplib::detail::read_content(*mStream, response, CPPHTTPLIB_PAYLOAD_MAX_LENGTH, status, progress, receiver, true);
+    }
+
+
+    void RestSocket::setReadTimeOut(std::chrono::microseconds timeOut)
+    {
+        if(mStream != nullptr)
+            mStream->setReadTimeOut(timeOut);
+    }
+
+
+    void RestSocket::resetReadTimeOut()
+    {
+        setReadTimeOut(std::chrono::seconds(mReadTimeOut));
+    }
+
+
+    void RestSocket::shutdown()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mSocket != INVALID_SOCKET)
+            httplib::detail::shutdown_socket(mSocket);
+    }
+
+
+    void RestSocket::close()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStream.reset();
+        if(mSocket != INVALID_SOCKET)
+        {
+            httplib::detail::shutdown_socket(mSocket);
+            httplib::detail::close_socket(mSocket);
+            mSocket = INVALID_SOCKET;
+        }
+    }
+}
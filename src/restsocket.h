@@ -0,0 +1,102 @@
+#pragma once
+
+#include "httplibwrapper.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace nap
+{
+    /**
+     * Plain TCP connection that writes raw HTTP/1.1 requests and reads the responses one by one, used by RestPipeline.
+     * httplib has no public api to write requests without waiting for their response,
+     * this class wraps all httplib internals (httplib::detail) the pipeline depends on:
+     * connecting, socket reads and writes, and the status line, header and body parsers.
+     * Review this class when the vendored httplib is upgraded.
+     * Not thread safe, only shutdown can be called from other threads.
+     */
+    class RestSocket final
+    {
+    public:
+        /**
+         * @param connectionTimeOut connection timeout in seconds
+         * @param readTimeOut read timeout in seconds, applies to every read on the socket
+         * @param writeTimeOut write timeout in seconds, applies to every write on the socket
+         */
+        RestSocket(time_t connectionTimeOut, time_t readTimeOut, time_t writeTimeOut);
+
+        // Closes the connection
+        ~RestSocket();
+
+        /**
+         * Opens a new connection, closes the current connection first
+         * @param host the host to connect to
+         * @param port the port to connect to
+         * @param error the error when the connection can't be opened
+         * @return true on success
+         */
+        bool connect(const std::string& host, int port, std::string& error);
+
+        /**
+         * @return if a connection is open and the upstream did not close it
+         */
+        bool isAlive() const;
+
+        /**
+         * @return if a connection is open, it might have been closed by the upstream since
+         */
+        bool isOpen() const { return mStream != nullptr; }
+
+        /**
+         * Writes data to the connection
+         * @param data the data to write
+         * @return false when the write fails or times out
+         */
+        bool write(const std::string& data);
+
+        /**
+         * Reads the next final response, interim 1xx responses are skipped.
+         * @param response the response to read into
+         * @param progress optional, receives the progress of the response body
+         * @param delimited set to false when the body is only delimited by the upstream closing the connection
+         * @return false when the read fails, times out or the upstream switches protocols
+         */
+        bool read(httplib::Response& response, const httplib::Progress& progress, bool& delimited);
+
+        /**
+         * Overrides the read timeout of the following reads, applies to every read on the socket
+         * @param timeOut the read timeout
+         */
+        void setReadTimeOut(std::chrono::microseconds timeOut);
+
+        /**
+         * @return the read timeout given on construction
+         */
+        std::chrono::seconds getReadTimeOut() const { return std::chrono::seconds(mReadTimeOut); }
+
+        /**
+         * Restores the read timeout given on construction
+         */
+        void resetReadTimeOut();
+
+        /**
+         * Unblocks the thread that is reading or writing, the connection can't be used afterwards. Safe to call from any thread.
+         */
+        void shutdown();
+
+        // Closes the connection
+        void close();
+
+    private:
+        class Stream;
+
+        time_t mConnectionTimeOut;
+        time_t mReadTimeOut;
+        time_t mWriteTimeOut;
+
+        std::mutex mMutex;                  ///< Guards the socket, shutdown is called from other threads
+        socket_t mSocket = INVALID_SOCKET;
+        std::unique_ptr<Stream> mStream;    ///< Buffers reads, responses can arrive in a single read
+    };
+}
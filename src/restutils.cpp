@@ -18,7 +18,7 @@ namespace nap
             document.Accept(writer);
 
             RestResponse response;
-            response.mData = buffer.GetString();
+            response.setData(buffer.GetString());
             response.mContentType = "application/json";
 
             return response;
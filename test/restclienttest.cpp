@@ -0,0 +1,544 @@
+// Tests the RestClient against loopback upstreams: deduplication and cancellation, circuit breaker probes,
+// pipelining and its fallback, cache freshness and revalidation, and resuming an interrupted download.
+// Callbacks are executed on the main thread, completed requests are picked up by running the update loop of the RestService.
+// Returns the number of failed checks, every failed check is printed.
+
+#include <restclient.h>
+#include <restcache.h>
+#include <restservice.h>
+#include <httplibwrapper.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+using namespace nap;
+using Clock = std::chrono::steady_clock;
+
+static int sFailures = 0;
+
+// Records a failed check
+static void expect(bool condition, const char* test, const char* what)
+{
+    if(!condition)
+    {
+        sFailures++;
+        std::printf("FAILED %s : %s\n", test, what);
+    }
+}
+
+
+/**
+ * httplib server on a free loopback port, handlers are registered before the server is started
+ */
+class TestServer final
+{
+public:
+    ~TestServer()
+    {
+        mServer.stop();
+        if(mThread.joinable())
+            mThread.join();
+    }
+
+    // Starts listening, returns the port
+    int start()
+    {
+        mPort = mServer.bind_to_any_port("127.0.0.1");
+        mThread = std::thread([this]() { mServer.listen_after_bind(); });
+        mServer.wait_until_ready();
+        return mPort;
+    }
+
+    httplib::Server mServer;
+    int mPort = 0;
+
+private:
+    std::thread mThread;
+};
+
+
+/**
+ * Upstream that answers every GET request on a connection in order, as soon as its headers are complete, so it supports pipelining.
+ * The body echoes the query. Records the largest number of requests that arrived in a single read.
+ */
+class PipelineServer final
+{
+public:
+    PipelineServer()
+    {
+        mSocket = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        ::bind(mSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        ::listen(mSocket, 16);
+        ::getsockname(mSocket, reinterpret_cast<sockaddr*>(&address), &length);
+        mPort = ntohs(address.sin_port);
+
+        mThread = std::thread([this]()
+        {
+            int connection;
+            while((connection = ::accept(mSocket, nullptr, nullptr)) >= 0)
+                mConnections.emplace_back([this, connection]() { serve(connection); });
+        });
+    }
+
+    ~PipelineServer()
+    {
+        ::shutdown(mSocket, SHUT_RDWR);
+        ::close(mSocket);
+        mThread.join();
+        for(auto& connection : mConnections)
+            connection.join();
+    }
+
+    int mPort = 0;
+    std::atomic<int> mMaxBatch = { 0 };
+
+private:
+    void serve(int connection)
+    {
+        std::string received;
+        char buffer[16 * 1024];
+        while(true)
+        {
+            auto size = ::recv(connection, buffer, sizeof(buffer), 0);
+            if(size <= 0)
+                break;
+            received.append(buffer, size);
+
+            // Every complete request is answered right away, requests that arrived together are answered together
+            std::string responses;
+            size_t end;
+            int batch = 0;
+            while((end = received.find("\r\n\r\n")) != std::string::npos)
+            {
+                auto target_start = received.find(' ') + 1;
+                auto query = received.substr(target_start, received.find(' ', target_start) - target_start);
+                query = query.substr(std::min(query.find('?') + 1, query.size()));
+                responses += "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(query.size()) + "\r\n\r\n" + query;
+                received.erase(0, end + 4);
+                batch++;
+            }
+            mMaxBatch = std::max(mMaxBatch.load(), batch);
+            ::send(connection, responses.data(), responses.size(), MSG_NOSIGNAL);
+        }
+        ::close(connection);
+    }
+
+    int mSocket = -1;
+    std::thread mThread;
+    std::vector<std::thread> mConnections;
+};
+
+
+/**
+ * Client under test and the service that completes its requests
+ */
+class TestClient final
+{
+public:
+    TestClient(int port) : mService(nullptr), mClient(mService)
+    {
+        mClient.mURL = "http://127.0.0.1:" + std::to_string(port);
+    }
+
+    ~TestClient()
+    {
+        if(mStarted)
+            mClient.stop();
+    }
+
+    bool start()
+    {
+        utility::ErrorState error_state;
+        mStarted = mClient.init(error_state) && mClient.start(error_state);
+        if(!mStarted)
+            std::printf("Unable to start client : %s\n", error_state.toString().c_str());
+        return mStarted;
+    }
+
+    // Runs the update loop of the service until the condition holds, returns false when it times out
+    bool update(const std::function<bool()>& condition, std::chrono::milliseconds timeOut = std::chrono::seconds(5))
+    {
+        auto deadline = Clock::now() + timeOut;
+        while(!condition())
+        {
+            if(Clock::now() > deadline)
+                return false;
+            mService.update(0.0);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    // Runs the update loop of the service for the given time
+    void updateFor(std::chrono::milliseconds duration)
+    {
+        update([]() { return false; }, duration);
+    }
+
+    // Sends a get request and waits for it to complete, returns true on success
+    bool get(const std::string& address, std::string* body = nullptr, bool* shared = nullptr)
+    {
+        bool done = false, success = false;
+        mClient.get(address, {}, [&](const RestResponse& response)
+        {
+            if(body != nullptr)
+                *body = response.getData();
+            if(shared != nullptr)
+                *shared = response.isShared();
+            success = done = true;
+        }, [&](const utility::ErrorState&)
+        {
+            done = true;
+        });
+        update([&]() { return done; });
+        return success;
+    }
+
+    RestService mService;
+    RestClient mClient;
+
+private:
+    bool mStarted = false;
+};
+
+
+// Identical requests share a single request, cancelling one of them doesn't cancel the other
+static void testDeduplicateCancel()
+{
+    const char* test = "deduplicate and cancel";
+    std::atomic<int> hits = { 0 };
+    TestServer server;
+    server.mServer.Get("/slow", [&hits](const httplib::Request&, httplib::Response& res)
+    {
+        hits++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        res.set_content("slow", "text/plain");
+    });
+
+    TestClient client(server.start());
+    if(!client.start())
+        return expect(false, test, "client starts");
+
+    bool first_called = false, second_done = false;
+    std::string second_body;
+    auto first = client.mClient.get("/slow", {}, [&](const RestResponse&) { first_called = true; }, [&](const utility::ErrorState&) { first_called = true; });
+    client.mClient.get("/slow", {}, [&](const RestResponse& response)
+    {
+        second_body = response.getData();
+        second_done = true;
+    }, [&](const utility::ErrorState&) { second_done = true; });
+    first.cancel();
+
+    expect(client.update([&]() { return second_done; }), test, "attached request completes");
+    client.updateFor(std::chrono::milliseconds(50));
+    expect(second_body == "slow", test, "attached request receives the body");
+    expect(!first_called, test, "cancelled request doesn't call back");
+    expect(hits == 1, test, "identical requests are sent once");
+    expect(client.mClient.getDeduplicatedCount() == 1, test, "deduplicated count");
+
+    // Cancelling every request of a shared request drops it, the connection is used again afterwards
+    bool cancelled_called = false;
+    auto third = client.mClient.get("/slow", {}, [&](const RestResponse&) { cancelled_called = true; }, [&](const utility::ErrorState&) { cancelled_called = true; });
+    auto fourth = client.mClient.get("/slow", {}, [&](const RestResponse&) { cancelled_called = true; }, [&](const utility::ErrorState&) { cancelled_called = true; });
+    third.cancel();
+    fourth.cancel();
+    client.updateFor(std::chrono::milliseconds(300));
+    expect(!cancelled_called, test, "cancelled shared request doesn't call back");
+    expect(third.isCancelled() && fourth.isCancelled(), test, "handles report the cancellation");
+
+    std::string body;
+    expect(client.get("/slow", &body) && body == "slow", test, "request after cancellation succeeds");
+}
+
+
+// The circuit opens after consecutive failures, probes the upstream once it has been open long enough and closes when a probe succeeds
+static void testCircuitHalfOpen()
+{
+    const char* test = "circuit breaker";
+    std::atomic<int> hits = { 0 };
+    std::atomic<bool> failing = { true };
+    TestServer server;
+    server.mServer.Get("/flaky", [&](const httplib::Request&, httplib::Response& res)
+    {
+        hits++;
+        res.status = failing ? httplib::StatusCode::ServiceUnavailable_503 : httplib::StatusCode::OK_200;
+        res.set_content("flaky", "text/plain");
+    });
+
+    TestClient client(server.start());
+    client.mClient.mCircuitBreaker.mEnabled = true;
+    client.mClient.mCircuitBreaker.mFailureThreshold = 2;
+    client.mClient.mCircuitBreaker.mOpenDuration = 0.2f;
+    client.mClient.mCircuitBreaker.mProbeCount = 1;
+    if(!client.start())
+        return expect(false, test, "client starts");
+
+    // Responses with a retryable status are delivered as is when no attempts are left, but count as failures
+    client.get("/flaky");
+    expect(client.mClient.getCircuitState() == ERestCircuitState::Closed, test, "circuit stays closed below the threshold");
+    client.get("/flaky");
+    expect(client.mClient.getCircuitState() == ERestCircuitState::Open, test, "circuit opens after the threshold");
+
+    expect(!client.get("/flaky"), test, "open circuit fails requests");
+    expect(hits == 2, test, "open circuit doesn't send requests");
+    expect(client.mClient.getRejectedCount() == 1, test, "rejected count");
+
+    // A failed probe opens the circuit again
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    client.get("/flaky");
+    expect(hits == 3, test, "probe is sent");
+    expect(client.mClient.getCircuitState() == ERestCircuitState::Open, test, "failed probe opens the circuit");
+    expect(!client.get("/flaky") && hits == 3, test, "circuit is open after a failed probe");
+
+    // A successful probe closes the circuit
+    failing = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    expect(client.get("/flaky"), test, "successful probe succeeds");
+    expect(client.mClient.getCircuitState() == ERestCircuitState::Closed, test, "successful probe closes the circuit");
+    expect(client.get("/flaky") && hits == 5, test, "closed circuit sends requests");
+}
+
+
+// Sends a number of distinct requests at once and checks every response belongs to its request
+static bool sendEchoes(TestClient& client, int count)
+{
+    std::vector<std::string> bodies(count);
+    int completed = 0;
+    int failed = 0;
+    for(int i = 0; i < count; i++)
+    {
+        std::vector<std::unique_ptr<APIBaseValue>> params;
+        params.emplace_back(std::make_unique<APIInt>("i", i));
+        client.mClient.get("/echo", params, [&bodies, &completed, i](const RestResponse& response)
+        {
+            bodies[i] = response.getData();
+            completed++;
+        }, [&completed, &failed](const utility::ErrorState& errorState)
+        {
+            std::printf("%s\n", errorState.toString().c_str());
+            completed++;
+            failed++;
+        });
+    }
+
+    if(!client.update([&]() { return completed == count; }, std::chrono::seconds(10)) || failed > 0)
+        return false;
+    for(int i = 0; i < count; i++)
+    {
+        if(bodies[i] != "i=" + std::to_string(i))
+            return false;
+    }
+    return true;
+}
+
+
+// Requests are written back to back to an upstream that supports it, and sent again one by one when the upstream drops them
+static void testPipelining()
+{
+    const char* test = "pipelining";
+    {
+        PipelineServer server;
+        TestClient client(server.mPort);
+        client.mClient.mPipelining = true;
+        client.mClient.mPipelineDepth = 4;
+        if(!client.start())
+            return expect(false, test, "client starts");
+
+        expect(sendEchoes(client, 16), test, "pipelined responses arrive in order");
+        expect(server.mMaxBatch > 1, test, "requests are written back to back");
+        expect(sendEchoes(client, 16), test, "pipeline keeps working");
+    }
+
+    // The httplib server reads every request through a new buffered stream, requests that arrived with the previous request are lost
+    {
+        TestServer server;
+        server.mServer.Get("/echo", [](const httplib::Request& req, httplib::Response& res)
+        {
+            res.set_content("i=" + req.get_param_value("i"), "text/plain");
+        });
+        TestClient client(server.start());
+        client.mClient.mPipelining = true;
+        client.mClient.mPipelineDepth = 4;
+        if(!client.start())
+            return expect(false, test, "client starts");
+
+        expect(sendEchoes(client, 16), test, "dropped requests are sent again");
+        expect(sendEchoes(client, 16), test, "requests succeed after falling back");
+    }
+}
+
+
+// Formats a time as HTTP date
+static std::string toHTTPDate(std::time_t time)
+{
+    char buffer[64];
+    std::tm tm = *std::gmtime(&time);
+    std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buffer;
+}
+
+
+// Fresh responses are served from the cache, stale responses are revalidated and a 304 reuses the cached body
+static void testCache()
+{
+    const char* test = "cache";
+    std::atomic<int> fresh = { 0 }, expires = { 0 }, validated = { 0 }, not_modified = { 0 };
+    TestServer server;
+    server.mServer.Get("/fresh", [&fresh](const httplib::Request&, httplib::Response& res)
+    {
+        fresh++;
+        res.set_header("Cache-Control", "max-age=60");
+        res.set_content("fresh", "text/plain");
+    });
+    server.mServer.Get("/expires", [&expires](const httplib::Request&, httplib::Response& res)
+    {
+        expires++;
+        auto now = std::time(nullptr);
+        res.set_header("Date", toHTTPDate(now));
+        res.set_header("Expires", toHTTPDate(now + 60));
+        res.set_content("expires", "text/plain");
+    });
+    server.mServer.Get("/validated", [&validated, &not_modified](const httplib::Request& req, httplib::Response& res)
+    {
+        res.set_header("ETag", "\"v1\"");
+        if(req.get_header_value("If-None-Match") == "\"v1\"")
+        {
+            not_modified++;
+            res.status = httplib::StatusCode::NotModified_304;
+            return;
+        }
+        validated++;
+        res.set_content("validated", "text/plain");
+    });
+
+    RestCache cache;
+    utility::ErrorState error_state;
+    if(!cache.init(error_state))
+        return expect(false, test, "cache initializes");
+
+    TestClient client(server.start());
+    client.mClient.mCache = &cache;
+    if(!client.start())
+        return expect(false, test, "client starts");
+
+    std::string body;
+    bool shared = false;
+    expect(client.get("/fresh", &body) && body == "fresh", test, "first request succeeds");
+    expect(client.get("/fresh", &body, &shared) && body == "fresh", test, "fresh response is served from the cache");
+    expect(fresh == 1 && cache.getHitCount() == 1, test, "fresh response is not requested again");
+    expect(shared, test, "cached body is shared, not copied");
+
+    expect(client.get("/expires") && client.get("/expires", &body) && body == "expires", test, "expires requests succeed");
+    expect(expires == 1, test, "response is fresh until it expires");
+
+    expect(client.get("/validated") && client.get("/validated", &body) && body == "validated", test, "revalidated response keeps its body");
+    expect(validated == 1 && not_modified == 1, test, "stale response is revalidated");
+    expect(cache.getRevalidatedCount() == 1, test, "revalidated count");
+}
+
+
+// A download that failed halfway continues from the bytes it already received
+static void testDownloadResume()
+{
+    const char* test = "download resume";
+    std::string data(512 * 1024, '\0');
+    for(size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<char>((i * 31) % 251);
+
+    std::atomic<bool> interrupt = { true };
+    std::mutex mutex;
+    std::vector<std::string> ranges;
+    TestServer server;
+    server.mServer.Get("/file", [&](const httplib::Request& req, httplib::Response& res)
+    {
+        if(req.method == "GET")
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ranges.emplace_back(req.get_header_value("Range"));
+        }
+
+        // The first transfer breaks off after a part of the file
+        auto sent = std::make_shared<size_t>(0);
+        res.set_header("ETag", "\"file-v1\"");
+        res.set_content_provider(data.size(), "application/octet-stream", [&data, &interrupt, sent](size_t offset, size_t length, httplib::DataSink& sink)
+        {
+            if(interrupt && *sent >= data.size() / 4)
+                return false;
+            length = std::min<size_t>(length, 16 * 1024);
+            *sent += length;
+            return sink.write(data.data() + offset, length);
+        });
+    });
+
+    auto directory = std::filesystem::temp_directory_path() / ("naprest_test_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory);
+    auto path = (directory / "file.bin").string();
+
+    TestClient client(server.start());
+    if(!client.start())
+        return expect(false, test, "client starts");
+
+    RestDownloadOptions options;
+    options.mSegments = 1;
+    bool done = false, success = false;
+    RestDownloadResult result;
+    auto download = [&]()
+    {
+        done = success = false;
+        client.mClient.download("/file", {}, path, [&](const RestDownloadResult& downloaded)
+        {
+            result = downloaded;
+            success = done = true;
+        }, [&](const utility::ErrorState&) { done = true; }, options);
+        return client.update([&]() { return done; });
+    };
+
+    expect(download() && !success, test, "interrupted download fails");
+    expect(!std::filesystem::exists(path), test, "interrupted download is not moved into place");
+
+    interrupt = false;
+    expect(download() && success, test, "resumed download succeeds");
+    expect(result.mSize == data.size(), test, "size of the resumed download");
+    expect(result.mResumedBytes > 0, test, "bytes of the interrupted download are reused");
+
+    std::ifstream file(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    expect(contents == data, test, "resumed file matches");
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        expect(ranges.size() == 2 && ranges.back().compare(0, 6, "bytes=") == 0 && ranges.back() != ranges.front(), test, "resumed download asks for the remainder");
+    }
+
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+}
+
+
+int main()
+{
+    testDeduplicateCancel();
+    testCircuitHalfOpen();
+    testPipelining();
+    testCache();
+    testDownloadResume();
+
+    if(sFailures == 0)
+        std::printf("All tests passed\n");
+    return sFailures;
+}